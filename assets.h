@@ -0,0 +1,129 @@
+/* assets.h - file, image and mesh loading shared by the renderer and cpu_bench
+
+   Do this:
+      #define ASSETS_IMPLEMENTATION
+   before you include this file in *one* C file to create the implementation.
+
+   Nothing here touches OpenGL, so it can be timed without a GPU.
+*/
+#ifndef ASSETS_H
+#define ASSETS_H
+
+// Interleaved mesh: 8 floats per vertex (position, normal, texcoord)
+typedef struct {
+    float* vertices;
+    unsigned int* indices;
+    int vertex_count;
+    int index_count;
+} Mesh;
+
+unsigned char* loadBMP(const char* filename, int* width, int* height);
+char* load_file(const char* filename);
+void generate_sphere_mesh(Mesh* mesh, int latSegments, int lonSegments);
+void free_mesh(Mesh* mesh);
+
+#endif // ASSETS_H
+
+#ifdef ASSETS_IMPLEMENTATION
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Simple BMP loader for 24-bit uncompressed BMP
+unsigned char* loadBMP(const char* filename, int* width, int* height) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) return NULL;
+    unsigned char header[54];
+    fread(header, 1, 54, f);
+    if (header[0] != 'B' || header[1] != 'M') { fclose(f); return NULL; }
+    *width = *(int*)&header[18];
+    *height = *(int*)&header[22];
+    int bpp = *(short*)&header[28];
+    if (bpp != 24) { fclose(f); return NULL; }
+    int row_padded = (*width * 3 + 3) & (~3);
+    unsigned char* data = (unsigned char*)malloc(row_padded * (*height));
+    if (!data) { fclose(f); return NULL; }
+    fread(data, 1, row_padded * (*height), f);
+    fclose(f);
+    // BMP is BGR and upside down, convert to RGB and flip
+    unsigned char* rgb = (unsigned char*)malloc(3 * (*width) * (*height));
+    for (int y = 0; y < *height; ++y) {
+        for (int x = 0; x < *width; ++x) {
+            int bmp_idx = (y * row_padded) + x * 3;
+            int rgb_idx = ((*height - 1 - y) * (*width) + x) * 3;
+            rgb[rgb_idx + 0] = data[bmp_idx + 2];
+            rgb[rgb_idx + 1] = data[bmp_idx + 1];
+            rgb[rgb_idx + 2] = data[bmp_idx + 0];
+        }
+    }
+    free(data);
+    return rgb;
+}
+
+// Shader loading utility
+char* load_file(const char* filename) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* buf = (char*)malloc(len + 1);
+    fread(buf, 1, len, f);
+    buf[len] = 0;
+    fclose(f);
+    return buf;
+}
+
+// Sphere mesh generation (positions, normals, texcoords, indices), radius 0.4
+void generate_sphere_mesh(Mesh* mesh, int latSegments, int lonSegments) {
+    mesh->vertex_count = (latSegments + 1) * (lonSegments + 1);
+    mesh->index_count = latSegments * lonSegments * 6;
+    float* vertices = (float*)malloc(mesh->vertex_count * 8 * sizeof(float));
+    unsigned int* indices = (unsigned int*)malloc(mesh->index_count * sizeof(unsigned int));
+    int v = 0;
+    for (int i = 0; i <= latSegments; ++i) {
+        float lat = (float)i / latSegments * 3.1415926f;
+        float y = cosf(lat);
+        float r = sinf(lat);
+        for (int j = 0; j <= lonSegments; ++j) {
+            float lon = (float)j / lonSegments * 2.0f * 3.1415926f;
+            float x = r * cosf(lon);
+            float z = r * sinf(lon);
+            // Position
+            vertices[v++] = x * 0.4f;
+            vertices[v++] = y * 0.4f;
+            vertices[v++] = z * 0.4f;
+            // Normal
+            vertices[v++] = x;
+            vertices[v++] = y;
+            vertices[v++] = z;
+            // Texcoord
+            vertices[v++] = (float)j / lonSegments;
+            vertices[v++] = (float)i / latSegments;
+        }
+    }
+    int idx = 0;
+    for (int i = 0; i < latSegments; ++i) {
+        for (int j = 0; j < lonSegments; ++j) {
+            int first = i * (lonSegments + 1) + j;
+            int second = first + lonSegments + 1;
+            indices[idx++] = first;
+            indices[idx++] = second;
+            indices[idx++] = first + 1;
+            indices[idx++] = second;
+            indices[idx++] = second + 1;
+            indices[idx++] = first + 1;
+        }
+    }
+    mesh->vertices = vertices;
+    mesh->indices = indices;
+}
+
+void free_mesh(Mesh* mesh) {
+    free(mesh->vertices);
+    free(mesh->indices);
+    mesh->vertices = NULL;
+    mesh->indices = NULL;
+}
+
+#endif // ASSETS_IMPLEMENTATION
@@ -0,0 +1,437 @@
+/* bvh.h - bounding volume hierarchy over bounding spheres
+
+   Do this:
+      #define BVH_IMPLEMENTATION
+   before you include this file in *one* C file to create the implementation.
+
+   Objects are bounding spheres in SoA arrays, as frustum_cull_spheres()
+   takes them. The tree is built top-down with the binned surface area
+   heuristic and stored as one flat array of 32-byte nodes: the two children
+   of a node are adjacent and always come after it, so a refit is one
+   backwards sweep. Leaves hold a contiguous run of the spheres, copied in
+   leaf order so a leaf test touches one cache line or two.
+
+   A moved object is refitted with bvh_update(), which grows or shrinks the
+   boxes on its path to the root; the topology is kept, so the tree slowly
+   loses quality if objects travel far, and should then be rebuilt.
+
+   Queries: frustum (the same sphere test as frustum_cull_spheres(), so the
+   results match it), axis-aligned box overlap and nearest ray hit.
+*/
+#ifndef BVH_H
+#define BVH_H
+
+typedef struct {
+    float min[3], max[3];
+    int first; // Leaf: first sphere slot; inner node: left child, the right one follows it
+    int count; // Leaf: number of spheres; inner node: 0
+} BvhNode;
+
+typedef struct {
+    BvhNode* nodes;
+    int node_count;
+    int* parent;   // Per node; -1 for the root
+    float* sphere; // Per slot: x, y, z, r in leaf order
+    int* object;   // Per slot: object index
+    int* slot;     // Per object: its slot
+    int* leaf;     // Per object: its leaf node
+    int count;     // Objects
+    int depth;     // Levels below the root
+} Bvh;
+
+// Builds the tree over n spheres (SoA centers x/y/z, radii r). bvh must be
+// zeroed or hold a previous tree, which is freed.
+void bvh_build(Bvh* bvh, const float* x, const float* y, const float* z, const float* r, int n);
+void bvh_free(Bvh* bvh);
+// Moves object i and refits the boxes above it
+void bvh_update(Bvh* bvh, int i, float x, float y, float z, float r);
+// Refits every box after the spheres were changed in place
+void bvh_refit(Bvh* bvh);
+// visible[i] = 1 if sphere i touches the frustum (planes from
+// frustum_planes()), else 0; returns the number visible
+int  bvh_query_frustum(const Bvh* bvh, unsigned char* visible, const float planes[6][4]);
+// Writes up to maxOut indices of the objects whose sphere's bounding box
+// overlaps [lo, hi] to out; returns how many overlap
+int  bvh_query_aabb(const Bvh* bvh, const float* lo, const float* hi, int* out, int maxOut);
+// Index of the nearest sphere hit by origin + t * dir with 0 <= t <= *t,
+// and its t in *t; -1 (and *t unchanged) when nothing is hit
+int  bvh_query_ray(const Bvh* bvh, const float* origin, const float* dir, float* t);
+
+#endif // BVH_H
+
+#ifdef BVH_IMPLEMENTATION
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BVH_BINS 16          // SAH split candidates per axis
+#define BVH_MAX_LEAF 4       // Spheres per leaf; larger runs are always split
+#define BVH_SAH_MAX_DEPTH 64 // Deeper nodes split at the median, which bounds the depth
+#define BVH_STACK_SIZE 96    // Traversal stack: BVH_SAH_MAX_DEPTH + 31 median levels + 1
+
+// An object's box and center during the build, partitioned in place
+typedef struct {
+    float min[3], max[3], center[3];
+    int object;
+} BvhRef;
+
+static void bvh_box_empty(float* lo, float* hi) {
+    for (int a = 0; a < 3; ++a) {
+        lo[a] = 1e30f;
+        hi[a] = -1e30f;
+    }
+}
+
+// Written as selects so they compile to minss/maxss: branches here
+// mispredict on every other object during a build
+static void bvh_box_grow(float* lo, float* hi, const float* bmin, const float* bmax) {
+    for (int a = 0; a < 3; ++a) {
+        lo[a] = bmin[a] < lo[a] ? bmin[a] : lo[a];
+        hi[a] = bmax[a] > hi[a] ? bmax[a] : hi[a];
+    }
+}
+
+// Half the surface area, which is all the heuristic compares
+static float bvh_box_area(const float* lo, const float* hi) {
+    float dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+    return dx < 0.0f ? 0.0f : dx * dy + dy * dz + dz * dx;
+}
+
+static void bvh_node_fit(Bvh* bvh, int node) {
+    BvhNode* n = &bvh->nodes[node];
+    bvh_box_empty(n->min, n->max);
+    if (n->count) {
+        for (int s = n->first; s < n->first + n->count; ++s) {
+            const float* sp = &bvh->sphere[s * 4];
+            float lo[3] = { sp[0] - sp[3], sp[1] - sp[3], sp[2] - sp[3] };
+            float hi[3] = { sp[0] + sp[3], sp[1] + sp[3], sp[2] + sp[3] };
+            bvh_box_grow(n->min, n->max, lo, hi);
+        }
+    } else {
+        bvh_box_grow(n->min, n->max, bvh->nodes[n->first].min, bvh->nodes[n->first].max);
+        bvh_box_grow(n->min, n->max, bvh->nodes[n->first + 1].min, bvh->nodes[n->first + 1].max);
+    }
+}
+
+// Makes nodes[node] cover refs[start, start + count) and splits it
+static void bvh_build_node(Bvh* bvh, BvhRef* refs, int node, int start, int count, int depth) {
+    BvhNode* n = &bvh->nodes[node];
+    if (depth > bvh->depth) bvh->depth = depth;
+    float clo[3], chi[3]; // Bounds of the centers
+    bvh_box_empty(n->min, n->max);
+    bvh_box_empty(clo, chi);
+    for (int k = start; k < start + count; ++k) {
+        bvh_box_grow(n->min, n->max, refs[k].min, refs[k].max);
+        bvh_box_grow(clo, chi, refs[k].center, refs[k].center);
+    }
+    if (count <= BVH_MAX_LEAF) {
+        n->first = start; // Slots are assigned in build order
+        n->count = count;
+        return;
+    }
+    // Bin the centers along all three axes in one pass; small nodes, which
+    // are most of them, get one bin per sphere
+    int bins = count < BVH_BINS ? count : BVH_BINS;
+    float scale[3];
+    for (int a = 0; a < 3; ++a) scale[a] = chi[a] > clo[a] ? bins / (chi[a] - clo[a]) : 0.0f;
+    int binCount[3][BVH_BINS] = { { 0 } };
+    float binLo[3][BVH_BINS][3], binHi[3][BVH_BINS][3];
+    for (int a = 0; a < 3; ++a)
+        for (int k = 0; k < bins; ++k) bvh_box_empty(binLo[a][k], binHi[a][k]);
+    for (int k = start; k < start + count; ++k) {
+        for (int a = 0; a < 3; ++a) {
+            int bin = (int)((refs[k].center[a] - clo[a]) * scale[a]);
+            bin = bin < bins - 1 ? bin : bins - 1;
+            binCount[a][bin]++;
+            bvh_box_grow(binLo[a][bin], binHi[a][bin], refs[k].min, refs[k].max);
+        }
+    }
+    // Cheapest split over every axis's bins: the children's sphere counts
+    // weighted by their area
+    int bestAxis = -1, bestBin = 0;
+    float bestCost = 1e30f;
+    for (int a = 0; a < 3 && depth < BVH_SAH_MAX_DEPTH; ++a) {
+        if (scale[a] == 0.0f) continue;
+        // Sweep from the right for the right-hand areas, then from the left
+        float rightArea[BVH_BINS];
+        int rightCount[BVH_BINS];
+        float lo[3], hi[3];
+        bvh_box_empty(lo, hi);
+        int total = 0;
+        for (int k = bins - 1; k > 0; --k) {
+            bvh_box_grow(lo, hi, binLo[a][k], binHi[a][k]);
+            total += binCount[a][k];
+            rightArea[k] = bvh_box_area(lo, hi);
+            rightCount[k] = total;
+        }
+        bvh_box_empty(lo, hi);
+        total = 0;
+        for (int k = 0; k < bins - 1; ++k) {
+            bvh_box_grow(lo, hi, binLo[a][k], binHi[a][k]);
+            total += binCount[a][k];
+            if (!total || !rightCount[k + 1]) continue;
+            float cost = total * bvh_box_area(lo, hi) + rightCount[k + 1] * rightArea[k + 1];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = a;
+                bestBin = k;
+            }
+        }
+    }
+    int split;
+    if (bestAxis >= 0) {
+        // Partition on the winning bin boundary, binning exactly as above
+        int lo = start, hi = start + count - 1;
+        while (lo <= hi) {
+            int bin = (int)((refs[lo].center[bestAxis] - clo[bestAxis]) * scale[bestAxis]);
+            if (bin <= bestBin) {
+                lo++;
+            } else {
+                BvhRef t = refs[lo];
+                refs[lo] = refs[hi];
+                refs[hi--] = t;
+            }
+        }
+        split = lo - start;
+    } else {
+        split = count / 2; // Centers all equal, or too deep: halve the run
+    }
+    int left = bvh->node_count;
+    bvh->node_count += 2;
+    n->first = left;
+    n->count = 0;
+    bvh->parent[left] = bvh->parent[left + 1] = node;
+    bvh_build_node(bvh, refs, left, start, split, depth + 1);
+    bvh_build_node(bvh, refs, left + 1, start + split, count - split, depth + 1);
+}
+
+void bvh_free(Bvh* bvh) {
+    free(bvh->nodes);
+    free(bvh->parent);
+    free(bvh->sphere);
+    free(bvh->object);
+    free(bvh->slot);
+    free(bvh->leaf);
+    memset(bvh, 0, sizeof(*bvh));
+}
+
+void bvh_build(Bvh* bvh, const float* x, const float* y, const float* z, const float* r, int n) {
+    bvh_free(bvh);
+    int maxNodes = n > 0 ? 2 * n - 1 : 1;
+    bvh->nodes = (BvhNode*)malloc(maxNodes * sizeof(BvhNode));
+    bvh->parent = (int*)malloc(maxNodes * sizeof(int));
+    bvh->sphere = (float*)malloc((n > 0 ? n : 1) * 4 * sizeof(float));
+    bvh->object = (int*)malloc((n > 0 ? n : 1) * sizeof(int));
+    bvh->slot = (int*)malloc((n > 0 ? n : 1) * sizeof(int));
+    bvh->leaf = (int*)malloc((n > 0 ? n : 1) * sizeof(int));
+    if (!bvh->nodes || !bvh->parent || !bvh->sphere || !bvh->object || !bvh->slot || !bvh->leaf) {
+        printf("Out of memory for a BVH over %d objects\n", n);
+        exit(1);
+    }
+    bvh->count = n;
+    bvh->node_count = 1;
+    bvh->parent[0] = -1;
+    BvhRef* refs = (BvhRef*)malloc((n > 0 ? n : 1) * sizeof(BvhRef));
+    if (!refs) {
+        printf("Out of memory for a BVH over %d objects\n", n);
+        exit(1);
+    }
+    for (int i = 0; i < n; ++i) {
+        BvhRef* ref = &refs[i];
+        ref->center[0] = x[i];
+        ref->center[1] = y[i];
+        ref->center[2] = z[i];
+        for (int a = 0; a < 3; ++a) {
+            ref->min[a] = ref->center[a] - r[i];
+            ref->max[a] = ref->center[a] + r[i];
+        }
+        ref->object = i;
+    }
+    bvh_build_node(bvh, refs, 0, 0, n, 0);
+    // Copy the spheres into leaf order
+    for (int s = 0; s < n; ++s) {
+        int i = refs[s].object;
+        bvh->sphere[s * 4] = x[i];
+        bvh->sphere[s * 4 + 1] = y[i];
+        bvh->sphere[s * 4 + 2] = z[i];
+        bvh->sphere[s * 4 + 3] = r[i];
+        bvh->object[s] = i;
+        bvh->slot[i] = s;
+    }
+    free(refs);
+    for (int node = 0; node < bvh->node_count; ++node) {
+        const BvhNode* nd = &bvh->nodes[node];
+        for (int s = nd->first; nd->count && s < nd->first + nd->count; ++s) bvh->leaf[bvh->object[s]] = node;
+    }
+}
+
+void bvh_update(Bvh* bvh, int i, float x, float y, float z, float r) {
+    float* sp = &bvh->sphere[bvh->slot[i] * 4];
+    sp[0] = x;
+    sp[1] = y;
+    sp[2] = z;
+    sp[3] = r;
+    for (int node = bvh->leaf[i]; node >= 0; node = bvh->parent[node]) bvh_node_fit(bvh, node);
+}
+
+void bvh_refit(Bvh* bvh) {
+    if (!bvh->count) return;
+    for (int node = bvh->node_count - 1; node >= 0; --node) bvh_node_fit(bvh, node);
+}
+
+// Tests the box against the planes in mask (bit p = planes[p]): -1 if it
+// is outside one, else the mask of the planes it still crosses
+static int bvh_box_frustum(const BvhNode* n, const float planes[6][4], int mask) {
+    int crossing = 0;
+    for (int p = 0; p < 6; ++p) {
+        if (!(mask & (1 << p))) continue;
+        const float* pl = planes[p];
+        // Corner farthest along the normal, and the one farthest against it
+        float far = pl[3], near = pl[3];
+        for (int a = 0; a < 3; ++a) {
+            far += pl[a] * (pl[a] > 0.0f ? n->max[a] : n->min[a]);
+            near += pl[a] * (pl[a] > 0.0f ? n->min[a] : n->max[a]);
+        }
+        if (far < 0.0f) return -1;
+        if (near < 0.0f) crossing |= 1 << p;
+    }
+    return crossing;
+}
+
+// Marks every object below node visible; returns how many. A subtree's
+// spheres are one run of slots, from its leftmost to its rightmost leaf.
+static int bvh_mark_subtree(const Bvh* bvh, int node, unsigned char* visible) {
+    int first = node, last = node;
+    while (!bvh->nodes[first].count) first = bvh->nodes[first].first;
+    while (!bvh->nodes[last].count) last = bvh->nodes[last].first + 1;
+    int begin = bvh->nodes[first].first, end = bvh->nodes[last].first + bvh->nodes[last].count;
+    for (int s = begin; s < end; ++s) visible[bvh->object[s]] = 1;
+    return end - begin;
+}
+
+// Planes a box lies fully inside hold for everything below it, so each
+// stack entry carries the planes still to test
+int bvh_query_frustum(const Bvh* bvh, unsigned char* visible, const float planes[6][4]) {
+    memset(visible, 0, bvh->count);
+    if (!bvh->count) return 0;
+    int stack[BVH_STACK_SIZE][2], top = 0, count = 0;
+    stack[top][0] = 0;
+    stack[top++][1] = 0x3f;
+    while (top) {
+        --top;
+        int node = stack[top][0];
+        const BvhNode* n = &bvh->nodes[node];
+        int mask = bvh_box_frustum(n, planes, stack[top][1]);
+        if (mask < 0) continue;
+        if (!mask) {
+            count += bvh_mark_subtree(bvh, node, visible);
+        } else if (n->count) {
+            for (int s = n->first; s < n->first + n->count; ++s) {
+                const float* sp = &bvh->sphere[s * 4];
+                int inside = 1;
+                for (int p = 0; p < 6 && inside; ++p)
+                    inside = planes[p][0] * sp[0] + planes[p][1] * sp[1] + planes[p][2] * sp[2] + planes[p][3] >= -sp[3];
+                visible[bvh->object[s]] = (unsigned char)inside;
+                count += inside;
+            }
+        } else {
+            stack[top][0] = n->first;
+            stack[top++][1] = mask;
+            stack[top][0] = n->first + 1;
+            stack[top++][1] = mask;
+        }
+    }
+    return count;
+}
+
+static int bvh_box_overlap(const float* amin, const float* amax, const float* bmin, const float* bmax) {
+    return amin[0] <= bmax[0] && amax[0] >= bmin[0] && amin[1] <= bmax[1] && amax[1] >= bmin[1] &&
+           amin[2] <= bmax[2] && amax[2] >= bmin[2];
+}
+
+int bvh_query_aabb(const Bvh* bvh, const float* lo, const float* hi, int* out, int maxOut) {
+    if (!bvh->count) return 0;
+    int stack[BVH_STACK_SIZE], top = 0, count = 0;
+    stack[top++] = 0;
+    while (top) {
+        const BvhNode* n = &bvh->nodes[stack[--top]];
+        if (!bvh_box_overlap(n->min, n->max, lo, hi)) continue;
+        if (!n->count) {
+            stack[top++] = n->first;
+            stack[top++] = n->first + 1;
+            continue;
+        }
+        for (int s = n->first; s < n->first + n->count; ++s) {
+            const float* sp = &bvh->sphere[s * 4];
+            float smin[3] = { sp[0] - sp[3], sp[1] - sp[3], sp[2] - sp[3] };
+            float smax[3] = { sp[0] + sp[3], sp[1] + sp[3], sp[2] + sp[3] };
+            if (!bvh_box_overlap(smin, smax, lo, hi)) continue;
+            if (count < maxOut) out[count] = bvh->object[s];
+            count++;
+        }
+    }
+    return count;
+}
+
+// Entry t of the ray into the box, or 1e30 when it misses within [0, tMax]
+static float bvh_ray_box(const BvhNode* n, const float* origin, const float* inv, float tMax) {
+    float t0 = 0.0f, t1 = tMax;
+    for (int a = 0; a < 3; ++a) {
+        float ta = (n->min[a] - origin[a]) * inv[a], tb = (n->max[a] - origin[a]) * inv[a];
+        if (ta > tb) {
+            float t = ta;
+            ta = tb;
+            tb = t;
+        }
+        if (ta > t0) t0 = ta;
+        if (tb < t1) t1 = tb;
+    }
+    return t0 <= t1 ? t0 : 1e30f;
+}
+
+int bvh_query_ray(const Bvh* bvh, const float* origin, const float* dir, float* t) {
+    if (!bvh->count) return -1;
+    float inv[3] = { 1.0f / dir[0], 1.0f / dir[1], 1.0f / dir[2] };
+    float a = dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2];
+    float tBest = *t;
+    int hit = -1;
+    int stack[BVH_STACK_SIZE], top = 0;
+    if (bvh_ray_box(&bvh->nodes[0], origin, inv, tBest) < 1e30f) stack[top++] = 0;
+    while (top) {
+        const BvhNode* n = &bvh->nodes[stack[--top]];
+        if (n->count) {
+            for (int s = n->first; s < n->first + n->count; ++s) {
+                const float* sp = &bvh->sphere[s * 4];
+                float oc[3] = { origin[0] - sp[0], origin[1] - sp[1], origin[2] - sp[2] };
+                float b = dir[0] * oc[0] + dir[1] * oc[1] + dir[2] * oc[2];
+                float c = oc[0] * oc[0] + oc[1] * oc[1] + oc[2] * oc[2] - sp[3] * sp[3];
+                float disc = b * b - a * c;
+                if (disc < 0.0f) continue;
+                float root = sqrtf(disc);
+                float th = (-b - root) / a;
+                if (th < 0.0f) th = (-b + root) / a; // Origin inside the sphere
+                if (th >= 0.0f && th <= tBest) {
+                    tBest = th;
+                    hit = bvh->object[s];
+                }
+            }
+            continue;
+        }
+        // Visit the nearer child first, and only children entered before the best hit
+        int left = n->first;
+        float tl = bvh_ray_box(&bvh->nodes[left], origin, inv, tBest);
+        float tr = bvh_ray_box(&bvh->nodes[left + 1], origin, inv, tBest);
+        if (tl <= tr) {
+            if (tr < 1e30f) stack[top++] = left + 1;
+            if (tl < 1e30f) stack[top++] = left;
+        } else {
+            if (tl < 1e30f) stack[top++] = left;
+            if (tr < 1e30f) stack[top++] = left + 1;
+        }
+    }
+    if (hit >= 0) *t = tBest;
+    return hit;
+}
+
+#endif // BVH_IMPLEMENTATION
@@ -0,0 +1,443 @@
+// CPU microbenchmarks for the renderer's CPU-side hot paths (no GPU needed).
+//
+//   gcc -O2 cpu_bench.c -lm -pthread -o cpu_bench
+//   cpu_bench [--filter <substring>] [--json]
+//
+// Each benchmark runs in batches until BENCH_MIN_SECONDS have passed, and
+// that is repeated BENCH_REPETITIONS times; the median time per iteration is
+// reported. Benchmark names are stable so results can be diffed across commits.
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#define VECMATH_IMPLEMENTATION
+#include "vecmath.h"
+
+#define ASSETS_IMPLEMENTATION
+#include "assets.h"
+
+#define OCCLUSION_IMPLEMENTATION
+#include "occlusion.h"
+
+#define BVH_IMPLEMENTATION
+#include "bvh.h"
+
+#define BENCH_MIN_SECONDS 0.1
+#define BENCH_REPETITIONS 5
+#define BENCH_MAX_ITERATIONS 1000000000L
+#define BATCH_SIZE 1024
+
+double now_seconds(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+// Results are folded into this so the compiler cannot drop the work
+volatile float bench_sink;
+
+typedef struct {
+    const char* name;
+    void (*run)(long iterations, const void* arg);
+    const void* arg;
+    int items; // Items processed per iteration (0 = not reported)
+} Benchmark;
+
+// --- Math ---
+void bm_mat4_multiply(long iterations, const void* arg) {
+    float a[16], b[16];
+    mat4_perspective(a, 0.8f, 1.33f, 0.1f, 50.0f);
+    mat4_lookAt(b, (float[3]){ 3, 4, 5 }, (float[3]){ 0, 0, 0 }, (float[3]){ 0, 1, 0 });
+    for (long i = 0; i < iterations; ++i) {
+        mat4_multiply(a, a, b);
+        a[0] = 1.0f; // Keep values bounded
+    }
+    bench_sink = a[5];
+}
+
+void bm_mat4_multiply_batch(long iterations, const void* arg) {
+    static mat4 a, b[BATCH_SIZE], out[BATCH_SIZE];
+    mat4_lookAt(a.m, (float[3]){ 3, 4, 5 }, (float[3]){ 0, 0, 0 }, (float[3]){ 0, 1, 0 });
+    for (int i = 0; i < BATCH_SIZE; ++i) {
+        mat4_identity(b[i].m);
+        b[i].m[12] = (float)i;
+    }
+    for (long i = 0; i < iterations; ++i) mat4_multiply_batch(out, &a, b, BATCH_SIZE);
+    bench_sink = out[BATCH_SIZE - 1].m[12];
+}
+
+void bm_mat4_transform_points(long iterations, const void* arg) {
+    static mat4 m;
+    static vec4 in[BATCH_SIZE], out[BATCH_SIZE];
+    mat4_lookAt(m.m, (float[3]){ 3, 4, 5 }, (float[3]){ 0, 0, 0 }, (float[3]){ 0, 1, 0 });
+    for (int i = 0; i < BATCH_SIZE; ++i) {
+        in[i].v[0] = (float)i;
+        in[i].v[1] = 1.0f;
+        in[i].v[2] = -(float)i;
+        in[i].v[3] = 1.0f;
+    }
+    for (long i = 0; i < iterations; ++i) mat4_transform_points(out, &m, in, BATCH_SIZE);
+    bench_sink = out[BATCH_SIZE - 1].v[2];
+}
+
+void bm_mat4_lookAt(long iterations, const void* arg) {
+    float view[16];
+    float eye[3] = { 3, 4, 5 };
+    float sum = 0.0f;
+    for (long i = 0; i < iterations; ++i) {
+        eye[0] = (float)(i & 7);
+        mat4_lookAt(view, eye, (float[3]){ 0, 0, 0 }, (float[3]){ 0, 1, 0 });
+        sum += view[14];
+    }
+    bench_sink = sum;
+}
+
+void bm_mat4_perspective(long iterations, const void* arg) {
+    float proj[16];
+    float sum = 0.0f;
+    for (long i = 0; i < iterations; ++i) {
+        mat4_perspective(proj, 0.8f, 1.0f + (i & 7) * 0.1f, 0.1f, 50.0f);
+        sum += proj[0];
+    }
+    bench_sink = sum;
+}
+
+void bm_frustum_cull_spheres(long iterations, const void* arg) {
+    static float x[BATCH_SIZE], y[BATCH_SIZE], z[BATCH_SIZE], r[BATCH_SIZE];
+    static unsigned char visible[BATCH_SIZE];
+    float view[16], proj[16], clip[16], planes[6][4];
+    mat4_perspective(proj, 0.8f, 1.33f, 0.1f, 50.0f);
+    mat4_lookAt(view, (float[3]){ 3, 4, 5 }, (float[3]){ 0, 0, 0 }, (float[3]){ 0, 1, 0 });
+    mat4_multiply(clip, view, proj);
+    frustum_planes(planes, clip);
+    // A 32x32 grid around the origin, roughly half of it in view
+    for (int i = 0; i < BATCH_SIZE; ++i) {
+        x[i] = (float)(i % 32) - 16.0f;
+        y[i] = 0.0f;
+        z[i] = (float)(i / 32) - 16.0f;
+        r[i] = 0.87f;
+    }
+    int sum = 0;
+    for (long i = 0; i < iterations; ++i) sum += frustum_cull_spheres(visible, planes, x, y, z, r, BATCH_SIZE);
+    bench_sink = (float)sum;
+}
+
+// --- Occlusion culling ---
+#define OCCLUSION_GRID 32768 // 64x8x64 cubes, as in cube --occlusion-scene
+const int occlusion_threads[] = { 0, 1 }; // 0 = one per CPU
+
+// The --occlusion-scene grid and camera: the front rows hide most of it
+void occlusion_scene(float* clip, float* x, float* y, float* z, float* r) {
+    float view[16], proj[16];
+    mat4_perspective(proj, 0.785f, 1.33f, 0.1f, 200.0f);
+    mat4_lookAt(view, (float[3]){ 67.6f, 10.4f, 67.6f }, (float[3]){ 0, 0, 0 }, (float[3]){ 0, 1, 0 });
+    mat4_multiply(clip, view, proj);
+    for (int i = 0; i < OCCLUSION_GRID; ++i) {
+        x[i] = (i / 512 - 31.5f) * 1.1f;
+        y[i] = (i / 64 % 8) * 1.1f;
+        z[i] = (i % 64 - 31.5f) * 1.1f;
+        r[i] = 0.87f;
+    }
+}
+
+void bm_occlusion_render_boxes(long iterations, const void* arg) {
+    static float x[OCCLUSION_GRID], y[OCCLUSION_GRID], z[OCCLUSION_GRID], r[OCCLUSION_GRID];
+    float clip[16];
+    occlusion_scene(clip, x, y, z, r);
+    OcclusionBuffer ob;
+    occlusion_init(&ob, *(const int*)arg);
+    for (long i = 0; i < iterations; ++i) occlusion_render_boxes(&ob, clip, x, y, z, 0.5f, OCCLUSION_GRID);
+    bench_sink = ob.depth[OCCLUSION_WIDTH * OCCLUSION_HEIGHT / 2 + OCCLUSION_WIDTH / 2];
+    occlusion_free(&ob);
+}
+
+void bm_occlusion_test_boxes(long iterations, const void* arg) {
+    static float x[OCCLUSION_GRID], y[OCCLUSION_GRID], z[OCCLUSION_GRID], r[OCCLUSION_GRID];
+    static unsigned char visible[OCCLUSION_GRID];
+    float clip[16];
+    occlusion_scene(clip, x, y, z, r);
+    OcclusionBuffer ob;
+    occlusion_init(&ob, *(const int*)arg);
+    occlusion_render_boxes(&ob, clip, x, y, z, 0.5f, OCCLUSION_GRID);
+    int sum = 0;
+    for (long i = 0; i < iterations; ++i) {
+        memset(visible, 1, sizeof(visible));
+        sum += occlusion_test_boxes(&ob, visible, x, y, z, r, OCCLUSION_GRID);
+    }
+    bench_sink = (float)sum;
+    occlusion_free(&ob);
+}
+
+// --- Spatial queries ---
+const int bvh_sizes[] = { 10000, 100000, 1000000 };
+
+// Spheres scattered at a constant density (one per 8 cubic units) and a
+// camera standing among them with a fixed view distance, so about as many
+// are in view at every size; built once per size
+typedef struct {
+    int n;
+    float *x, *y, *z, *r;
+    unsigned char* visible;
+    Bvh bvh;
+    float planes[6][4];
+    float side;
+} BvhScene;
+BvhScene bvh_scenes[3];
+
+BvhScene* bvh_scene(int n) {
+    int k = 0;
+    while (bvh_sizes[k] != n) ++k;
+    BvhScene* s = &bvh_scenes[k];
+    if (s->n) return s;
+    s->n = n;
+    s->x = (float*)malloc(n * sizeof(float));
+    s->y = (float*)malloc(n * sizeof(float));
+    s->z = (float*)malloc(n * sizeof(float));
+    s->r = (float*)malloc(n * sizeof(float));
+    s->visible = (unsigned char*)malloc(n);
+    if (!s->x || !s->y || !s->z || !s->r || !s->visible) { printf("Out of memory for %d spheres\n", n); exit(1); }
+    s->side = 2.0f * cbrtf((float)n);
+    unsigned seed = 1;
+    for (int i = 0; i < n; ++i) {
+        float* c[3] = { &s->x[i], &s->y[i], &s->z[i] };
+        for (int a = 0; a < 3; ++a) {
+            seed = seed * 1664525u + 1013904223u;
+            *c[a] = ((seed >> 8) / 16777216.0f - 0.5f) * s->side;
+        }
+        s->r[i] = 0.5f;
+    }
+    float view[16], proj[16], clip[16];
+    mat4_perspective(proj, 0.8f, 1.33f, 0.1f, 20.0f);
+    mat4_lookAt(view, (float[3]){ 0, 0, 0 }, (float[3]){ 0, 0, -1 }, (float[3]){ 0, 1, 0 });
+    mat4_multiply(clip, view, proj);
+    frustum_planes(s->planes, clip);
+    bvh_build(&s->bvh, s->x, s->y, s->z, s->r, n);
+    return s;
+}
+
+void bm_bvh_build(long iterations, const void* arg) {
+    BvhScene* s = bvh_scene(*(const int*)arg);
+    Bvh bvh;
+    memset(&bvh, 0, sizeof(bvh));
+    for (long i = 0; i < iterations; ++i) bvh_build(&bvh, s->x, s->y, s->z, s->r, s->n);
+    bench_sink = (float)bvh.node_count;
+    bvh_free(&bvh);
+}
+
+// The linear baseline for bvh_query_frustum
+void bm_frustum_cull_spheres_scene(long iterations, const void* arg) {
+    BvhScene* s = bvh_scene(*(const int*)arg);
+    int sum = 0;
+    for (long i = 0; i < iterations; ++i) sum += frustum_cull_spheres(s->visible, s->planes, s->x, s->y, s->z, s->r, s->n);
+    bench_sink = (float)sum;
+}
+
+void bm_bvh_query_frustum(long iterations, const void* arg) {
+    BvhScene* s = bvh_scene(*(const int*)arg);
+    int sum = 0;
+    for (long i = 0; i < iterations; ++i) sum += bvh_query_frustum(&s->bvh, s->visible, s->planes);
+    bench_sink = (float)sum;
+}
+
+// One pick ray per iteration, from the camera into the view
+void bm_bvh_query_ray(long iterations, const void* arg) {
+    BvhScene* s = bvh_scene(*(const int*)arg);
+    float origin[3] = { 0, 0, 0 };
+    int sum = 0;
+    for (long i = 0; i < iterations; ++i) {
+        float dir[3] = { ((i & 15) - 7.5f) * 0.02f, ((i >> 4 & 15) - 7.5f) * 0.02f, -1.0f };
+        float t = 1e30f;
+        sum += bvh_query_ray(&s->bvh, origin, dir, &t);
+    }
+    bench_sink = (float)sum;
+}
+
+// The objects in a 4x4x4 box, moved around the scene
+void bm_bvh_query_aabb(long iterations, const void* arg) {
+    BvhScene* s = bvh_scene(*(const int*)arg);
+    int out[256], sum = 0;
+    for (long i = 0; i < iterations; ++i) {
+        float lo[3] = { ((i & 7) - 4) * s->side * 0.1f, ((i >> 3 & 7) - 4) * s->side * 0.1f, 0.0f };
+        float hi[3] = { lo[0] + 4.0f, lo[1] + 4.0f, lo[2] + 4.0f };
+        sum += bvh_query_aabb(&s->bvh, lo, hi, out, 256);
+    }
+    bench_sink = (float)sum;
+}
+
+// One object moving back and forth, refitted up to the root each time
+void bm_bvh_update(long iterations, const void* arg) {
+    BvhScene* s = bvh_scene(*(const int*)arg);
+    for (long i = 0; i < iterations; ++i)
+        bvh_update(&s->bvh, 0, s->x[0] + (i & 1) * 0.25f, s->y[0], s->z[0], s->r[0]);
+    bvh_update(&s->bvh, 0, s->x[0], s->y[0], s->z[0], s->r[0]);
+    bench_sink = s->bvh.nodes[0].max[0];
+}
+
+// --- Mesh generation ---
+const int sphere_sizes[][2] = { { 16, 32 }, { 64, 128 }, { 256, 512 } };
+
+void bm_generate_sphere_mesh(long iterations, const void* arg) {
+    const int* size = (const int*)arg;
+    for (long i = 0; i < iterations; ++i) {
+        Mesh mesh;
+        generate_sphere_mesh(&mesh, size[0], size[1]);
+        bench_sink = mesh.vertices[mesh.vertex_count * 8 - 1];
+        free_mesh(&mesh);
+    }
+}
+
+// --- File and image loading ---
+void bm_loadBMP(long iterations, const void* arg) {
+    for (long i = 0; i < iterations; ++i) {
+        int w, h;
+        unsigned char* data = loadBMP((const char*)arg, &w, &h);
+        if (!data) { printf("Failed to load %s\n", (const char*)arg); exit(1); }
+        bench_sink = data[0];
+        free(data);
+    }
+}
+
+void bm_stbi_load(long iterations, const void* arg) {
+    for (long i = 0; i < iterations; ++i) {
+        int w, h, channels;
+        unsigned char* data = stbi_load((const char*)arg, &w, &h, &channels, 3);
+        if (!data) { printf("Failed to load %s\n", (const char*)arg); exit(1); }
+        bench_sink = data[0];
+        stbi_image_free(data);
+    }
+}
+
+void bm_load_file(long iterations, const void* arg) {
+    for (long i = 0; i < iterations; ++i) {
+        char* src = load_file((const char*)arg);
+        if (!src) { printf("Failed to load %s\n", (const char*)arg); exit(1); }
+        bench_sink = src[0];
+        free(src);
+    }
+}
+
+Benchmark benchmarks[] = {
+    { "mat4_multiply", bm_mat4_multiply, NULL, 0 },
+    { "mat4_multiply_batch/1024", bm_mat4_multiply_batch, NULL, BATCH_SIZE },
+    { "mat4_transform_points/1024", bm_mat4_transform_points, NULL, BATCH_SIZE },
+    { "mat4_lookAt", bm_mat4_lookAt, NULL, 0 },
+    { "mat4_perspective", bm_mat4_perspective, NULL, 0 },
+    { "frustum_cull_spheres/1024", bm_frustum_cull_spheres, NULL, BATCH_SIZE },
+    { "occlusion_render_boxes/32768", bm_occlusion_render_boxes, &occlusion_threads[0], OCCLUSION_GRID },
+    { "occlusion_render_boxes/32768/1thread", bm_occlusion_render_boxes, &occlusion_threads[1], OCCLUSION_GRID },
+    { "occlusion_test_boxes/32768", bm_occlusion_test_boxes, &occlusion_threads[0], OCCLUSION_GRID },
+    { "occlusion_test_boxes/32768/1thread", bm_occlusion_test_boxes, &occlusion_threads[1], OCCLUSION_GRID },
+    { "bvh_build/10000", bm_bvh_build, &bvh_sizes[0], 10000 },
+    { "bvh_build/100000", bm_bvh_build, &bvh_sizes[1], 100000 },
+    { "bvh_build/1000000", bm_bvh_build, &bvh_sizes[2], 1000000 },
+    { "frustum_cull_spheres/10000", bm_frustum_cull_spheres_scene, &bvh_sizes[0], 10000 },
+    { "bvh_query_frustum/10000", bm_bvh_query_frustum, &bvh_sizes[0], 10000 },
+    { "frustum_cull_spheres/100000", bm_frustum_cull_spheres_scene, &bvh_sizes[1], 100000 },
+    { "bvh_query_frustum/100000", bm_bvh_query_frustum, &bvh_sizes[1], 100000 },
+    { "frustum_cull_spheres/1000000", bm_frustum_cull_spheres_scene, &bvh_sizes[2], 1000000 },
+    { "bvh_query_frustum/1000000", bm_bvh_query_frustum, &bvh_sizes[2], 1000000 },
+    { "bvh_query_ray/10000", bm_bvh_query_ray, &bvh_sizes[0], 0 },
+    { "bvh_query_ray/100000", bm_bvh_query_ray, &bvh_sizes[1], 0 },
+    { "bvh_query_ray/1000000", bm_bvh_query_ray, &bvh_sizes[2], 0 },
+    { "bvh_query_aabb/10000", bm_bvh_query_aabb, &bvh_sizes[0], 0 },
+    { "bvh_query_aabb/100000", bm_bvh_query_aabb, &bvh_sizes[1], 0 },
+    { "bvh_query_aabb/1000000", bm_bvh_query_aabb, &bvh_sizes[2], 0 },
+    { "bvh_update/10000", bm_bvh_update, &bvh_sizes[0], 0 },
+    { "bvh_update/100000", bm_bvh_update, &bvh_sizes[1], 0 },
+    { "bvh_update/1000000", bm_bvh_update, &bvh_sizes[2], 0 },
+    { "generate_sphere_mesh/16x32", bm_generate_sphere_mesh, sphere_sizes[0], 0 },
+    { "generate_sphere_mesh/64x128", bm_generate_sphere_mesh, sphere_sizes[1], 0 },
+    { "generate_sphere_mesh/256x512", bm_generate_sphere_mesh, sphere_sizes[2], 0 },
+    { "loadBMP/rock_texture.bmp", bm_loadBMP, "rock_texture.bmp", 0 },
+    { "stbi_load/rock_texture.bmp", bm_stbi_load, "rock_texture.bmp", 0 },
+    { "load_file/vertex_shader.glsl", bm_load_file, "vertex_shader.glsl", 0 },
+    { "load_file/fragment_shader.glsl", bm_load_file, "fragment_shader.glsl", 0 },
+};
+
+int compare_doubles(const void* a, const void* b) {
+    double da = *(const double*)a, db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+// Median ns per iteration over BENCH_REPETITIONS timed runs
+double run_benchmark(const Benchmark* bm, long* iterations_out) {
+    // One untimed call first, so inputs built on first use (the BVH scenes)
+    // do not count towards the calibration below
+    bm->run(1, bm->arg);
+    // Grow the iteration count until one run takes BENCH_MIN_SECONDS
+    long iterations = 1;
+    for (;;) {
+        double start = now_seconds();
+        bm->run(iterations, bm->arg);
+        double elapsed = now_seconds() - start;
+        if (elapsed >= BENCH_MIN_SECONDS || iterations >= BENCH_MAX_ITERATIONS) break;
+        double scale = elapsed > 0.0 ? BENCH_MIN_SECONDS * 1.2 / elapsed : 10.0;
+        if (scale > 10.0) scale = 10.0;
+        iterations = (long)(iterations * scale) + 1;
+        if (iterations > BENCH_MAX_ITERATIONS) iterations = BENCH_MAX_ITERATIONS;
+    }
+    double ns[BENCH_REPETITIONS];
+    for (int r = 0; r < BENCH_REPETITIONS; ++r) {
+        double start = now_seconds();
+        bm->run(iterations, bm->arg);
+        ns[r] = (now_seconds() - start) * 1e9 / iterations;
+    }
+    qsort(ns, BENCH_REPETITIONS, sizeof(double), compare_doubles);
+    *iterations_out = iterations;
+    return ns[BENCH_REPETITIONS / 2];
+}
+
+int main(int argc, char** argv) {
+    const char* filter = NULL;
+    int json = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = 1;
+        } else {
+            printf("Usage: %s [--filter <substring>] [--json]\n", argv[0]);
+            return -1;
+        }
+    }
+
+    int count = (int)(sizeof(benchmarks) / sizeof(benchmarks[0]));
+    int first = 1;
+    if (json) printf("{\n  \"benchmarks\": [\n");
+    else printf("%-34s %14s %12s %16s\n", "Benchmark", "Time (ns)", "Iterations", "Items/s");
+    for (int i = 0; i < count; ++i) {
+        const Benchmark* bm = &benchmarks[i];
+        if (filter && !strstr(bm->name, filter)) continue;
+        long iterations;
+        double ns = run_benchmark(bm, &iterations);
+        double items_per_second = bm->items ? bm->items * 1e9 / ns : 0.0;
+        if (json) {
+            printf("%s    {\"name\": \"%s\", \"ns_per_iter\": %.2f, \"iterations\": %ld, \"items_per_second\": %.0f}",
+                   first ? "" : ",\n", bm->name, ns, iterations, items_per_second);
+        } else {
+            printf("%-34s %14.1f %12ld", bm->name, ns, iterations);
+            if (bm->items) printf(" %16.3g", items_per_second);
+            printf("\n");
+        }
+        first = 0;
+        fflush(stdout);
+    }
+    if (json) printf("\n  ]\n}\n");
+    return 0;
+}
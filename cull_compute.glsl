@@ -0,0 +1,99 @@
+#version 430 core
+// GPU frustum culling: one invocation per object and view. Survivors bump
+// their draw command's instance count and store their instance index in
+// that command's range of the visible buffer, which the vertex shaders read
+// as a per-instance attribute (INSTANCE_FETCH).
+//
+// With Hi-Z occlusion culling the camera (view 0) runs in two phases.
+// Phase 0 also tests the objects in the frustum against last frame's
+// pyramid; the ones it hides are marked pending instead of drawn. Phase 1
+// retests the pending objects against the pyramid of this frame's first
+// draws and appends the survivors to the late view's commands.
+layout(local_size_x = 64) in;
+
+#define MAX_VIEWS 6   // Camera + MAX_CASCADES + the camera's late phase
+#define MAX_BATCHES 8 // Meshes (draw commands) per view
+
+struct DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout(std430, binding = 0) readonly buffer Bounds { vec4 bounds[]; };  // Center, radius
+layout(std430, binding = 1) readonly buffer Batches { uint batchOf[]; }; // Object -> batch
+layout(std430, binding = 2) writeonly buffer Visible { uint visible[]; };
+layout(std430, binding = 3) buffer Commands { DrawCommand commands[]; };
+layout(std430, binding = 4) buffer Pending { uint pending[]; };         // Object hidden in phase 0
+
+uniform int objectCount;
+uniform int batchCount;
+uniform int firstView;                             // View of gl_WorkGroupID.y == 0
+uniform vec4 planes[MAX_VIEWS * 6];                // Per view: left, right, bottom, top, near, far
+uniform int commandIndex[MAX_VIEWS * MAX_BATCHES]; // -1 = batch not drawn in that view
+uniform int phase;
+uniform int occlusion;                             // Hi-Z test for view 0
+uniform int hizValid;                              // The pyramid holds a previous frame
+uniform mat4 viewProj;                             // Camera
+uniform sampler2D hiz;
+
+// 1 if the sphere's screen rectangle lies entirely behind the pyramid
+bool hiz_occluded(vec4 b)
+{
+    vec3 lo = vec3(1e30), hi = vec3(-1e30);
+    for (int i = 0; i < 8; ++i) {
+        vec3 corner = b.xyz + b.w * vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0,
+                                         (i & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = viewProj * vec4(corner, 1.0);
+        if (clip.w <= 0.0) return false; // Reaches behind the camera
+        vec3 ndc = clip.xyz / clip.w;
+        lo = min(lo, ndc);
+        hi = max(hi, ndc);
+    }
+    vec2 size = vec2(textureSize(hiz, 0));
+    vec2 pixelLo = clamp(lo.xy * 0.5 + 0.5, 0.0, 1.0) * size;
+    vec2 pixelHi = clamp(hi.xy * 0.5 + 0.5, 0.0, 1.0) * size;
+    // One level below the one where the rectangle spans 2x2 texels: up to
+    // 3x3 fetches, but the footprint picks up far less of the background
+    vec2 extent = pixelHi - pixelLo;
+    int levels = textureQueryLevels(hiz);
+    int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))) - 1, 0, levels - 1);
+    // Not textureSize(hiz, level): llvmpipe gets it wrong when the lod differs between invocations
+    ivec2 levelSize = max(ivec2(size) >> level, ivec2(1));
+    ivec2 p0 = min(ivec2(pixelLo) >> level, levelSize - 1);
+    ivec2 p1 = min(ivec2(pixelHi) >> level, levelSize - 1);
+    float farthest = 0.0;
+    for (int y = p0.y; y <= p1.y; ++y)
+        for (int x = p0.x; x <= p1.x; ++x)
+            farthest = max(farthest, texelFetch(hiz, ivec2(x, y), level).r);
+    return lo.z * 0.5 + 0.5 > farthest;
+}
+
+void main()
+{
+    uint object = gl_GlobalInvocationID.x;
+    int view = firstView + int(gl_WorkGroupID.y);
+    if (object >= uint(objectCount)) return;
+    vec4 b = bounds[object];
+    if (phase == 1) {
+        if (pending[object] == 0u || hiz_occluded(b)) return;
+    } else {
+        bool inside = true;
+        for (int p = 0; p < 6 && inside; ++p) {
+            vec4 plane = planes[view * 6 + p];
+            inside = dot(plane.xyz, b.xyz) + plane.w >= -b.w;
+        }
+        if (view == 0 && occlusion != 0) {
+            bool occluded = inside && hizValid != 0 && hiz_occluded(b);
+            pending[object] = occluded ? 1u : 0u;
+            if (occluded) return;
+        }
+        if (!inside) return;
+    }
+    int command = commandIndex[view * batchCount + int(batchOf[object])];
+    if (command < 0) return;
+    uint slot = atomicAdd(commands[command].instanceCount, 1u);
+    visible[commands[command].baseInstance + slot] = object;
+}
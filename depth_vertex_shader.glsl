@@ -1,10 +1,36 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 
-uniform mat4 lightSpaceMatrix;
-uniform mat4 model;
+// Permutation define, prepended by compile_shader(); default if compiled as-is
+#ifndef INSTANCE_FETCH
+#define INSTANCE_FETCH 0
+#endif
+
+#if INSTANCE_FETCH
+// GPU culling: the instance's model matrix is fetched by index, see vertex_shader.glsl
+layout (location = 11) in uint aInstanceIndex;
+uniform samplerBuffer instances;
+#else
+layout (location = 3) in mat4 aModel; // per instance
+#endif
+
+layout(std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    mat4 lightSpaceMatrices[4];
+    vec4 cascadeSplits; // View-space far distance of each cascade
+    vec3 lightDir;
+    int cascadeCount;
+    vec3 viewPos;
+};
+uniform int cascade;
 
 void main()
 {
-    gl_Position = lightSpaceMatrix * model * vec4(aPos, 1.0);
+#if INSTANCE_FETCH
+    int texel = int(aInstanceIndex) * 7;
+    mat4 aModel = mat4(texelFetch(instances, texel), texelFetch(instances, texel + 1),
+                       texelFetch(instances, texel + 2), texelFetch(instances, texel + 3));
+#endif
+    gl_Position = lightSpaceMatrices[cascade] * aModel * vec4(aPos, 1.0);
 } 
\ No newline at end of file
@@ -4,40 +4,99 @@ out vec4 FragColor;
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoord;
-in vec4 FragPosLightSpace;
+in vec3 ObjectColor;
+
+// Permutation defines, prepended by compile_shader(); defaults if compiled as-is
+#ifndef USE_TEXTURE
+#define USE_TEXTURE 1
+#endif
+#ifndef RECEIVE_SHADOWS
+#define RECEIVE_SHADOWS 1
+#endif
+#ifndef SHADOW_TAPS
+#define SHADOW_TAPS 4 // 1, 4, 9 or 16 (Poisson disk)
+#endif
 
 uniform sampler2D texture1;
-uniform sampler2D shadowMap;
-uniform vec3 lightDir;
-uniform vec3 viewPos;
-uniform vec3 objectColor;
-uniform int useTexture;
+uniform sampler2DArrayShadow shadowMap; // One layer per cascade
+layout(std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    mat4 lightSpaceMatrices[4];
+    vec4 cascadeSplits; // View-space far distance of each cascade
+    vec3 lightDir;
+    int cascadeCount;
+    vec3 viewPos;
+};
+
+#if RECEIVE_SHADOWS
+// SHADOW_TAPS: 1, 4 (2x2), 9 (3x3) or 16 (Poisson disk).
+// Every tap is a hardware 2x2 bilinear PCF lookup (GL_COMPARE_REF_TO_TEXTURE).
+const vec2 poissonDisk[16] = vec2[](
+    vec2(-0.94201624, -0.39906216), vec2(0.94558609, -0.76890725),
+    vec2(-0.09418410, -0.92938870), vec2(0.34495938, 0.29387760),
+    vec2(-0.91588581, 0.45771432), vec2(-0.81544232, -0.87912464),
+    vec2(-0.38277543, 0.27676845), vec2(0.97484398, 0.75648379),
+    vec2(0.44323325, -0.97511554), vec2(0.53742981, -0.47373420),
+    vec2(-0.26496911, -0.41893023), vec2(0.79197514, 0.19090188),
+    vec2(-0.24188840, 0.99706507), vec2(-0.81409955, 0.91437590),
+    vec2(0.19984126, 0.78641367), vec2(0.14383161, -0.14100790)
+);
 
-float calculateShadow(vec4 fragPosLightSpace)
+float calculateShadow(vec3 fragPos)
 {
+    // First cascade whose split lies beyond this fragment's view depth
+    float viewDepth = -(view * vec4(fragPos, 1.0)).z;
+    int cascade = 0;
+    for(int i = 0; i < cascadeCount - 1; ++i) {
+        if(viewDepth > cascadeSplits[i]) cascade = i + 1;
+    }
+    vec4 fragPosLightSpace = lightSpaceMatrices[cascade] * vec4(fragPos, 1.0);
     vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
     projCoords = projCoords * 0.5 + 0.5;
-    float closestDepth = texture(shadowMap, projCoords.xy).r; 
-    float currentDepth = projCoords.z;
+    if(projCoords.z > 1.0) return 0.0;
+    float layer = float(cascade);
+
     float bias = max(0.001 * (1.0 - dot(Normal, -lightDir)), 0.0001);  
-    float shadow = 0.0;
-	vec2 texelSize = 1.0 / textureSize(shadowMap, 0);
-	for(int x = -1; x <= 1; ++x) {
-		for(int y = -1; y <= 1; ++y) {
-			float pcfDepth = texture(shadowMap, projCoords.xy + vec2(x, y) * texelSize).r; 
-			shadow += currentDepth - bias > pcfDepth ? 1.0 : 0.0;
-		}
-	}
-	shadow /= 9.0;
-
-    if(projCoords.z > 1.0) shadow = 0.0;
-
-    return shadow;
+    float ref = projCoords.z - bias;
+	vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+#if SHADOW_TAPS == 1
+    lit = texture(shadowMap, vec4(projCoords.xy, layer, ref));
+#elif SHADOW_TAPS == 4
+    // Offsets of +-0.5 texel cover the same 3x3 footprint as the old loop
+    for(int x = 0; x < 2; ++x) {
+        for(int y = 0; y < 2; ++y) {
+            vec2 offset = (vec2(x, y) - 0.5) * texelSize;
+            lit += texture(shadowMap, vec4(projCoords.xy + offset, layer, ref));
+        }
+    }
+    lit /= 4.0;
+#elif SHADOW_TAPS == 9
+    for(int x = -1; x <= 1; ++x) {
+        for(int y = -1; y <= 1; ++y) {
+            lit += texture(shadowMap, vec4(projCoords.xy + vec2(x, y) * texelSize, layer, ref));
+        }
+    }
+    lit /= 9.0;
+#else
+    for(int i = 0; i < 16; ++i) {
+        lit += texture(shadowMap, vec4(projCoords.xy + poissonDisk[i] * 1.5 * texelSize, layer, ref));
+    }
+    lit /= 16.0;
+#endif
+
+    return 1.0 - lit;
 }
+#endif
 
 void main()
 {
-    vec3 color = useTexture == 1 ? texture(texture1, TexCoord).rgb : objectColor;
+#if USE_TEXTURE
+    vec3 color = texture(texture1, TexCoord).rgb;
+#else
+    vec3 color = ObjectColor;
+#endif
     vec3 norm = normalize(Normal);
     vec3 lightColor = vec3(1.0);
 
@@ -53,7 +112,11 @@ void main()
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
     vec3 specular = specularStrength * spec * lightColor;    
     
-    float shadow = calculateShadow(FragPosLightSpace);
+#if RECEIVE_SHADOWS
+    float shadow = calculateShadow(FragPos);
+#else
+    float shadow = 0.0;
+#endif
 
     vec3 lighting = ambient + (1.0 - shadow) * (diffuse + specular);
     FragColor = vec4(lighting * color, 1.0);
@@ -0,0 +1,32 @@
+#version 430 core
+// Builds one level of the Hi-Z pyramid: every texel holds the farthest depth
+// under it. Level 0 copies the main pass depth; each further level takes
+// the max of the 2x2 texels below. On odd sizes the last row and column
+// also take the leftover texels, so no source texel is dropped.
+layout(local_size_x = 8, local_size_y = 8) in;
+
+uniform sampler2D depth; // Copy of the main pass depth buffer
+uniform int level;
+layout(r32f, binding = 0) readonly uniform image2D src;  // level - 1
+layout(r32f, binding = 1) writeonly uniform image2D dst; // level
+
+void main()
+{
+    ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(dst);
+    if (any(greaterThanEqual(p, size))) return;
+    if (level == 0) {
+        imageStore(dst, p, vec4(texelFetch(depth, p, 0).r));
+        return;
+    }
+    ivec2 srcSize = imageSize(src);
+    ivec2 first = p * 2;
+    ivec2 last = min(first + 1, srcSize - 1);
+    if (p.x == size.x - 1) last.x = srcSize.x - 1;
+    if (p.y == size.y - 1) last.y = srcSize.y - 1;
+    float farthest = 0.0;
+    for (int y = first.y; y <= last.y; ++y)
+        for (int x = first.x; x <= last.x; ++x)
+            farthest = max(farthest, imageLoad(src, ivec2(x, y)).r);
+    imageStore(dst, p, vec4(farthest));
+}
@@ -1,65 +1,600 @@
+#ifdef _WIN32
 #include <windows.h>
+#endif
 //#include <src/gl.h>
 //#include "src/glad.c"
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h> // For malloc/free
+#include <stddef.h> // For offsetof
 #include <string.h> // For memset
+#include <sys/stat.h> // For mkdir/stat
+#ifdef _WIN32
+#include <direct.h> // For _mkdir
+#endif
+#ifdef __linux__
+#include <sys/inotify.h> // Shader hot reload
+#include <unistd.h>
+#endif
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#define VECMATH_IMPLEMENTATION
+#include "vecmath.h"
+
+#define ASSETS_IMPLEMENTATION
+#include "assets.h"
+
+#define OCCLUSION_IMPLEMENTATION
+#include "occlusion.h"
+
+#define BVH_IMPLEMENTATION
+#include "bvh.h"
+
 #include <glad/glad.h>
 #include "GLFW/glfw3.h"
 
-// Shadow map resolution
-const unsigned int SHADOW_WIDTH = 1024, SHADOW_HEIGHT = 1024;
-GLuint depthMapFBO;
-GLuint depthMap;
-GLuint depthShaderProgram;
-
-// Simple BMP loader for 24-bit uncompressed BMP
-unsigned char* loadBMP(const char* filename, int* width, int* height) {
-    FILE* f = fopen(filename, "rb");
-    if (!f) return NULL;
-    unsigned char header[54];
-    fread(header, 1, 54, f);
-    if (header[0] != 'B' || header[1] != 'M') { fclose(f); return NULL; }
-    *width = *(int*)&header[18];
-    *height = *(int*)&header[22];
-    int bpp = *(short*)&header[28];
-    if (bpp != 24) { fclose(f); return NULL; }
-    int row_padded = (*width * 3 + 3) & (~3);
-    unsigned char* data = (unsigned char*)malloc(row_padded * (*height));
-    if (!data) { fclose(f); return NULL; }
-    fread(data, 1, row_padded * (*height), f);
-    fclose(f);
-    // BMP is BGR and upside down, convert to RGB and flip
-    unsigned char* rgb = (unsigned char*)malloc(3 * (*width) * (*height));
-    for (int y = 0; y < *height; ++y) {
-        for (int x = 0; x < *width; ++x) {
-            int bmp_idx = (y * row_padded) + x * 3;
-            int rgb_idx = ((*height - 1 - y) * (*width) + x) * 3;
-            rgb[rgb_idx + 0] = data[bmp_idx + 2];
-            rgb[rgb_idx + 1] = data[bmp_idx + 1];
-            rgb[rgb_idx + 2] = data[bmp_idx + 0];
+// Shadow map resolution (per cascade) and cascade count, see --shadow-size / --cascades
+#define MAX_CASCADES 4
+int shadow_size = 1024;
+int shadow_cascades = 3;
+// Shadow filtering tier (shadowQuality in fragment_shader.glsl); P cycles it at runtime
+enum { SHADOW_TAPS_1, SHADOW_TAPS_4, SHADOW_TAPS_9, SHADOW_POISSON, SHADOW_QUALITY_COUNT };
+const char* shadow_quality_names[SHADOW_QUALITY_COUNT] = { "1 tap", "4 taps", "9 taps", "Poisson 16" };
+int shadow_quality = SHADOW_TAPS_4;
+GLuint depthMap;                  // GL_TEXTURE_2D_ARRAY, one layer per cascade
+GLuint cascadeFBOs[MAX_CASCADES]; // One FBO per layer
+
+GLuint g_tex = 0;
+
+// Depth texture array with one layer per cascade
+GLuint create_depth_array(int size, int layers) {
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT, size, size, layers, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    return tex;
+}
+
+// Depth-only FBOs, one per layer of tex
+void create_layer_fbos(GLuint tex, int layers, GLuint* fbos) {
+    glGenFramebuffers(layers, fbos);
+    for (int i = 0; i < layers; ++i) {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbos[i]);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, tex, 0, i);
+        glDrawBuffer(GL_NONE); // We don't need to draw color data
+        glReadBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            printf("ERROR::FRAMEBUFFER:: Shadow framebuffer is not complete!\n");
+            exit(1);
         }
     }
-    free(data);
-    return rgb;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-GLuint g_tex = 0;
+// --- GL State Cache ---
+// Per-frame code changes GL state through these wrappers, which remember the
+// current value and drop calls that would not change it. Uniform uploads
+// skipped by the program uniform cache are counted here too. Code that
+// touches the same state directly (setup, blits) must call
+// gl_state_invalidate() afterwards.
+enum { STATE_CAPABILITY, STATE_CULL_FACE, STATE_VIEWPORT, STATE_TEXTURE, STATE_PROGRAM, STATE_VAO,
+       STATE_FRAMEBUFFER, STATE_UNIFORM, STATE_KIND_COUNT };
+const char* state_kind_names[STATE_KIND_COUNT] = { "capability", "cull_face", "viewport", "texture", "program",
+                                                   "vao", "framebuffer", "uniform" };
+#define STATE_TEXTURE_UNITS 4
+#define STATE_UNKNOWN 0xFFFFFFFFu
+
+typedef struct {
+    int depth_test, cull_face;            // -1 = unknown
+    GLenum cull_mode;
+    GLint viewport[4];
+    GLenum active_unit;                   // Index, not GL_TEXTUREi
+    GLuint textures[STATE_TEXTURE_UNITS][3]; // GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BUFFER
+    GLuint program, vao, read_fbo, draw_fbo;
+    int issued[STATE_KIND_COUNT];         // This frame
+    int elided[STATE_KIND_COUNT];
+    long long total_issued[STATE_KIND_COUNT]; // Since the last reset, for the bench report
+    long long total_elided[STATE_KIND_COUNT];
+    int total_frames;
+    int last_issued, last_elided;         // Totals of the last finished frame, for the window title
+    int draw_calls, draw_commands;        // This frame; one multi-draw call can carry many commands
+    long long total_draw_calls, total_draw_commands;
+} GlState;
+GlState gl_state;
+
+// Scene draws go through glMultiDrawElementsIndirect; cleared by
+// --no-indirect or when the context lacks GL 4.3 / ARB_multi_draw_indirect
+int multi_draw_indirect = 1;
+
+void gl_state_invalidate(void) {
+    gl_state.depth_test = gl_state.cull_face = -1;
+    gl_state.cull_mode = STATE_UNKNOWN;
+    gl_state.viewport[2] = -1;
+    gl_state.active_unit = STATE_UNKNOWN;
+    memset(gl_state.textures, 0xFF, sizeof(gl_state.textures));
+    gl_state.program = gl_state.vao = gl_state.read_fbo = gl_state.draw_fbo = STATE_UNKNOWN;
+}
+
+// Returns 1 if the call has to be issued
+int gl_state_count(int kind, int changed) {
+    if (changed) gl_state.issued[kind]++;
+    else gl_state.elided[kind]++;
+    return changed;
+}
+
+// Folds this frame's counters into the totals and clears them
+void gl_state_end_frame(void) {
+    gl_state.last_issued = gl_state.last_elided = 0;
+    for (int k = 0; k < STATE_KIND_COUNT; ++k) {
+        gl_state.last_issued += gl_state.issued[k];
+        gl_state.last_elided += gl_state.elided[k];
+        gl_state.total_issued[k] += gl_state.issued[k];
+        gl_state.total_elided[k] += gl_state.elided[k];
+        gl_state.issued[k] = gl_state.elided[k] = 0;
+    }
+    gl_state.total_draw_calls += gl_state.draw_calls;
+    gl_state.total_draw_commands += gl_state.draw_commands;
+    gl_state.draw_calls = gl_state.draw_commands = 0;
+    gl_state.total_frames++;
+}
+
+void gl_state_reset_totals(void) {
+    memset(gl_state.total_issued, 0, sizeof(gl_state.total_issued));
+    memset(gl_state.total_elided, 0, sizeof(gl_state.total_elided));
+    gl_state.total_draw_calls = gl_state.total_draw_commands = 0;
+    gl_state.total_frames = 0;
+}
+
+void gl_state_set_capability(GLenum cap, int on) {
+    int* current = cap == GL_DEPTH_TEST ? &gl_state.depth_test : &gl_state.cull_face;
+    if (!gl_state_count(STATE_CAPABILITY, *current != on)) return;
+    *current = on;
+    if (on) glEnable(cap);
+    else glDisable(cap);
+}
+
+void gl_state_cull_face(GLenum mode) {
+    if (!gl_state_count(STATE_CULL_FACE, gl_state.cull_mode != mode)) return;
+    gl_state.cull_mode = mode;
+    glCullFace(mode);
+}
+
+void gl_state_viewport(GLint x, GLint y, GLint width, GLint height) {
+    GLint* v = gl_state.viewport;
+    if (!gl_state_count(STATE_VIEWPORT, v[0] != x || v[1] != y || v[2] != width || v[3] != height)) return;
+    v[0] = x; v[1] = y; v[2] = width; v[3] = height;
+    glViewport(x, y, width, height);
+}
+
+// For calls that act on the active unit's binding (glCopyTexSubImage2D)
+void gl_state_active_texture(int unit) {
+    if (gl_state.active_unit == (GLenum)unit) return;
+    gl_state.active_unit = unit;
+    glActiveTexture(GL_TEXTURE0 + unit);
+}
+
+// Binds tex to texture unit `unit`; only switches the active unit when needed
+void gl_state_bind_texture(int unit, GLenum target, GLuint tex) {
+    int slot = target == GL_TEXTURE_2D_ARRAY ? 1 : target == GL_TEXTURE_BUFFER ? 2 : 0;
+    GLuint* current = &gl_state.textures[unit][slot];
+    if (!gl_state_count(STATE_TEXTURE, *current != tex)) return;
+    *current = tex;
+    gl_state_active_texture(unit);
+    glBindTexture(target, tex);
+}
+
+void gl_state_use_program(GLuint program) {
+    if (!gl_state_count(STATE_PROGRAM, gl_state.program != program)) return;
+    gl_state.program = program;
+    glUseProgram(program);
+}
+
+void gl_state_bind_vao(GLuint vao) {
+    if (!gl_state_count(STATE_VAO, gl_state.vao != vao)) return;
+    gl_state.vao = vao;
+    glBindVertexArray(vao);
+}
+
+// target is GL_FRAMEBUFFER (both), GL_READ_FRAMEBUFFER or GL_DRAW_FRAMEBUFFER
+void gl_state_bind_framebuffer(GLenum target, GLuint fbo) {
+    int read = target != GL_DRAW_FRAMEBUFFER, draw = target != GL_READ_FRAMEBUFFER;
+    if (!gl_state_count(STATE_FRAMEBUFFER, (read && gl_state.read_fbo != fbo) || (draw && gl_state.draw_fbo != fbo)))
+        return;
+    if (read) gl_state.read_fbo = fbo;
+    if (draw) gl_state.draw_fbo = fbo;
+    glBindFramebuffer(target, fbo);
+}
+// --- End GL State Cache ---
+
+// --- Static Shadow Cache ---
+// Static casters (the cube grid) are rendered into their own depth texture
+// only when a cascade's light matrix or the static geometry changes. Every
+// frame that depth is blitted into the shadow map and only dynamic casters
+// are drawn on top, so the shadow pass scales with the dynamic objects, not
+// the scene. Texel snapping keeps cascade matrices stable while the camera
+// holds still, so cached layers stay valid.
+typedef struct {
+    GLuint fbos[MAX_CASCADES];
+    GLuint depth;
+    float lightSpace[MAX_CASCADES][16]; // Light matrix each layer was rendered with
+    int valid[MAX_CASCADES];
+    int layers;
+    int renders;                        // Layers (re)rendered so far
+} ShadowCache;
+
+int shadow_cache_enabled = 1;
+ShadowCache static_shadows;
+
+void shadow_cache_init(ShadowCache* cache, int size, int layers) {
+    memset(cache, 0, sizeof(*cache));
+    cache->layers = layers;
+    // Same format as depthMap, which glBlitFramebuffer requires for depth copies
+    cache->depth = create_depth_array(size, layers);
+    create_layer_fbos(cache->depth, layers, cache->fbos);
+}
+
+// Call whenever static geometry is added, moved or removed
+void shadow_cache_invalidate(ShadowCache* cache) {
+    memset(cache->valid, 0, sizeof(cache->valid));
+}
+
+// Returns 1 (with the layer's FBO bound and cleared) if the static casters
+// have to be re-rendered for this light matrix, 0 if the cached depth is current
+int shadow_cache_begin(ShadowCache* cache, int layer, const float* lightSpace) {
+    if (cache->valid[layer] && memcmp(cache->lightSpace[layer], lightSpace, sizeof(cache->lightSpace[layer])) == 0)
+        return 0;
+    memcpy(cache->lightSpace[layer], lightSpace, sizeof(cache->lightSpace[layer]));
+    cache->valid[layer] = 1;
+    cache->renders++;
+    gl_state_bind_framebuffer(GL_FRAMEBUFFER, cache->fbos[layer]);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    return 1;
+}
+
+// Copies the cached static depth of one layer into dstFBO, replacing its depth contents
+void shadow_cache_blit(const ShadowCache* cache, int layer, GLuint dstFBO, int size) {
+    gl_state_bind_framebuffer(GL_READ_FRAMEBUFFER, cache->fbos[layer]);
+    gl_state_bind_framebuffer(GL_DRAW_FRAMEBUFFER, dstFBO);
+    glBlitFramebuffer(0, 0, size, size, 0, 0, size, size, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+}
+
+void shadow_cache_cleanup(ShadowCache* cache) {
+    glDeleteFramebuffers(cache->layers, cache->fbos);
+    glDeleteTextures(1, &cache->depth);
+}
+// --- End Static Shadow Cache ---
+
+// --- GPU Pass Timers ---
+// GL_TIME_ELAPSED queries are ring-buffered: a query is only read back
+// GPU_TIMER_LATENCY frames after it was issued, so reading never stalls.
+#define GPU_TIMER_LATENCY 3
+#define GPU_TIMER_HISTORY 60 // Samples in the rolling average
+enum { PASS_CULL, PASS_SHADOW, PASS_MAIN, PASS_HIZ, PASS_COUNT };
+// cull only runs with --gpu-cull; hiz (pyramid build, late cull and late draws) with --hiz
+const char* pass_names[PASS_COUNT] = { "cull", "shadow", "main", "hiz" };
+
+typedef struct {
+    GLuint queries[GPU_TIMER_LATENCY];
+    int pending[GPU_TIMER_LATENCY];
+    float history[GPU_TIMER_HISTORY];
+    int history_count, history_next;
+    double total_ms;  // Sum of every sample since the last reset
+    int total_count;
+    int skip;         // Samples still to discard
+} GpuTimer;
+GpuTimer gpu_timers[PASS_COUNT];
+
+void gpu_timers_init(void) {
+    memset(gpu_timers, 0, sizeof(gpu_timers));
+    for (int p = 0; p < PASS_COUNT; ++p) {
+        glGenQueries(GPU_TIMER_LATENCY, gpu_timers[p].queries);
+        // The first interval can include driver start-up (llvmpipe reports seconds)
+        gpu_timers[p].skip = 1;
+    }
+}
+
+void gpu_timers_reset(void) {
+    for (int p = 0; p < PASS_COUNT; ++p) {
+        gpu_timers[p].history_count = gpu_timers[p].history_next = 0;
+        gpu_timers[p].total_ms = 0.0;
+        gpu_timers[p].total_count = 0;
+        // Queries still in flight belong to the frames before the reset
+        memset(gpu_timers[p].pending, 0, sizeof(gpu_timers[p].pending));
+    }
+}
+
+// Read back a finished query into the history; wait forces a blocking read
+void gpu_timer_collect(GpuTimer* timer, int slot, int wait) {
+    if (!timer->pending[slot]) return;
+    GLint available = 0;
+    glGetQueryObjectiv(timer->queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available && !wait) return;
+    GLuint64 ns;
+    glGetQueryObjectui64v(timer->queries[slot], GL_QUERY_RESULT, &ns);
+    timer->pending[slot] = 0;
+    if (timer->skip > 0) { timer->skip--; return; }
+    float ms = (float)(ns / 1.0e6);
+    timer->history[timer->history_next] = ms;
+    timer->history_next = (timer->history_next + 1) % GPU_TIMER_HISTORY;
+    if (timer->history_count < GPU_TIMER_HISTORY) timer->history_count++;
+    timer->total_ms += ms;
+    timer->total_count++;
+}
+
+void gpu_timer_begin(int pass, int frame) {
+    GpuTimer* timer = &gpu_timers[pass];
+    int slot = frame % GPU_TIMER_LATENCY;
+    gpu_timer_collect(timer, slot, 0); // Result from GPU_TIMER_LATENCY frames ago
+    timer->pending[slot] = 0;          // Dropped if still not ready; the query is reissued
+    glBeginQuery(GL_TIME_ELAPSED, timer->queries[slot]);
+}
+
+void gpu_timer_end(int pass, int frame) {
+    glEndQuery(GL_TIME_ELAPSED);
+    gpu_timers[pass].pending[frame % GPU_TIMER_LATENCY] = 1;
+}
+
+// Blocks until every outstanding query has been read back
+void gpu_timers_drain(void) {
+    for (int p = 0; p < PASS_COUNT; ++p)
+        for (int slot = 0; slot < GPU_TIMER_LATENCY; ++slot)
+            gpu_timer_collect(&gpu_timers[p], slot, 1);
+}
+
+float gpu_timer_average_ms(int pass) {
+    const GpuTimer* timer = &gpu_timers[pass];
+    if (timer->history_count == 0) return 0.0f;
+    float sum = 0.0f;
+    for (int i = 0; i < timer->history_count; ++i) sum += timer->history[i];
+    return sum / timer->history_count;
+}
+
+void gpu_timers_cleanup(void) {
+    for (int p = 0; p < PASS_COUNT; ++p)
+        glDeleteQueries(GPU_TIMER_LATENCY, gpu_timers[p].queries);
+}
+// --- End GPU Pass Timers ---
+
+// --- Frustum Culling ---
+// Objects carry bounding spheres in SoA arrays so frustum_cull_spheres()
+// can test 4-8 of them per instruction. Each frame the camera frustum
+// culls the main pass and every cascade's light frustum culls its shadow
+// casters; only surviving instance runs are queued. With --bvh each set of
+// bounds also keeps a bvh.h tree, whose frustum query gives the same
+// result as the linear test but only visits the parts of the scene in view.
+typedef struct {
+    float *x, *y, *z, *r;  // Centers and radii
+    unsigned char* visible; // Scratch for the last test
+    int count;
+    Bvh bvh;                // Built with --bvh
+} CullBounds;
+
+// Planes of one frame's views
+typedef struct {
+    float camera[6][4];
+    float camera_clip[16]; // Projection * view, for the Hi-Z test
+    float light[MAX_CASCADES][6][4];
+    float eye[3];
+} CullViews;
+
+typedef struct {
+    int objects, main_visible, shadow_visible; // This frame; shadow sums every cascade
+    int late_visible;                          // Part of main_visible drawn by the Hi-Z late phase
+    int gpu;                                   // Counts read back from the GPU culling pass
+    const char* occlusion;                     // "none", "hiz" or "software"
+    long long total_main_visible, total_shadow_visible, total_late_visible;
+    double total_ms;
+    int total_frames;
+} CullStats;
+CullStats cull_stats;
+int frustum_cull_enabled = 1; // --no-cull draws everything
+int bvh_enabled = 0;          // --bvh
+
+void cull_bounds_resize(CullBounds* b, int count) {
+    b->x = (float*)realloc(b->x, count * sizeof(float));
+    b->y = (float*)realloc(b->y, count * sizeof(float));
+    b->z = (float*)realloc(b->z, count * sizeof(float));
+    b->r = (float*)realloc(b->r, count * sizeof(float));
+    b->visible = (unsigned char*)realloc(b->visible, count);
+    if (!b->x || !b->y || !b->z || !b->r || !b->visible) {
+        printf("Out of memory for %d bounding spheres\n", count);
+        exit(1);
+    }
+    b->count = count;
+}
+
+// Bounding sphere of a unit-size mesh (radius `radius` at scale 1) under model
+void cull_bounds_set(CullBounds* b, int i, const float* model, float radius) {
+    float sx = vec3_dot(&model[0], &model[0]), sy = vec3_dot(&model[4], &model[4]);
+    float sz = vec3_dot(&model[8], &model[8]);
+    float scale = sqrtf(sx > sy ? (sx > sz ? sx : sz) : (sy > sz ? sy : sz));
+    b->x[i] = model[12];
+    b->y[i] = model[13];
+    b->z[i] = model[14];
+    b->r[i] = radius * scale;
+}
+
+void cull_bounds_free(CullBounds* b) {
+    free(b->x);
+    free(b->y);
+    free(b->z);
+    free(b->r);
+    free(b->visible);
+    bvh_free(&b->bvh);
+    memset(b, 0, sizeof(*b));
+}
+
+void cull_views_update(CullViews* views, const float* view, const float* projection,
+                       const float lightSpace[][16], int cascades, const float* eye) {
+    mat4_multiply(views->camera_clip, view, projection); // projection * view
+    frustum_planes(views->camera, views->camera_clip);
+    for (int c = 0; c < cascades; ++c) frustum_planes(views->light[c], lightSpace[c]);
+    memcpy(views->eye, eye, sizeof(views->eye));
+}
+
+void cull_stats_end_frame(double ms) {
+    cull_stats.total_main_visible += cull_stats.main_visible;
+    cull_stats.total_shadow_visible += cull_stats.shadow_visible;
+    cull_stats.total_late_visible += cull_stats.late_visible;
+    cull_stats.total_ms += ms;
+    cull_stats.total_frames++;
+}
+
+void cull_stats_reset_totals(void) {
+    cull_stats.total_main_visible = cull_stats.total_shadow_visible = cull_stats.total_late_visible = 0;
+    cull_stats.total_ms = 0.0;
+    cull_stats.total_frames = 0;
+}
+// --- End Frustum Culling ---
+
+// --- Software Occlusion Culling ---
+// --sw-occlusion, the CPU culling path's alternative to --hiz: every frame
+// the cube grid is rasterized into occlusion.h's 256x128 depth buffer on a
+// pool of threads, and main pass objects that pass the frustum test are
+// dropped when the box around their bounding sphere lies behind it. No
+// readback, so it costs the same on llvmpipe as on a real GPU.
+#define CUBE_HALF_SIZE 0.5f // The cube mesh spans -0.5..0.5
+OcclusionBuffer sw_occlusion;
+int sw_occlusion_enabled = 0;
+int sw_occlusion_threads = 0; // --occlusion-threads, 0 = one per CPU
+// --- End Software Occlusion Culling ---
+
+// --- Benchmark Mode ---
+// --bench <frames> renders a fixed number of frames offscreen with a fixed
+// timestep and prints a JSON frame-time report to stdout.
+#define BENCH_WARMUP_FRAMES 10
+#define BENCH_TIMESTEP (1.0 / 60.0)
+const int WINDOW_WIDTH = 640, WINDOW_HEIGHT = 480;
+int bench_frames = 0;
+float stress_budget_ms = 0.0f;
+int headless = 0; // --bench or --stress: offscreen target, fixed timestep
+// --shader-normal-matrix goes back to computing the normal matrix per vertex,
+// so the bench can compare it with the per-instance one (with --sphere)
+int shader_normal_matrix = 0;
+
+// Shader program creation at startup, filled in by main() for the report
+typedef struct {
+    double programs_ms; // Main-thread time this launch spent creating and waiting on programs
+    double cold_ms;     // The run's shader variants compiled and linked from source
+    double warm_ms;     // The same variants loaded from the binary cache (< 0 = unsupported)
+    int cache_hits, cache_misses;
+    int parallel_compile; // Driver compiles on its own threads
+    int variants;         // Shader permutations built over the run
+} StartupTimes;
+StartupTimes startup_times;
+
+int compare_floats(const void* a, const void* b) {
+    float fa = *(const float*)a, fb = *(const float*)b;
+    return (fa > fb) - (fa < fb);
+}
+
+// Nearest-rank percentile of an ascending array
+float percentile(const float* sorted, int n, float p) {
+    int rank = (int)ceilf(p / 100.0f * n);
+    if (rank < 1) rank = 1;
+    if (rank > n) rank = n;
+    return sorted[rank - 1];
+}
+
+void print_bench_report(float* frame_ms, int n) {
+    double sum = 0.0;
+    for (int i = 0; i < n; ++i) sum += frame_ms[i];
+    qsort(frame_ms, n, sizeof(float), compare_floats);
+    printf("{\n");
+    printf("  \"frames\": %d,\n", n);
+    printf("  \"width\": %d,\n", WINDOW_WIDTH);
+    printf("  \"height\": %d,\n", WINDOW_HEIGHT);
+    printf("  \"renderer\": \"%s\",\n", (const char*)glGetString(GL_RENDERER));
+    printf("  \"shadow_quality\": \"%s\",\n", shadow_quality_names[shadow_quality]);
+    printf("  \"shadow_cascades\": %d,\n", shadow_cascades);
+    printf("  \"shadow_size\": %d,\n", shadow_size);
+    printf("  \"normal_matrix\": \"%s\",\n", shader_normal_matrix ? "shader" : "instance");
+    printf("  \"shadow_cache\": {\"enabled\": %s, \"static_renders\": %d},\n",
+           shadow_cache_enabled ? "true" : "false", static_shadows.renders);
+    printf("  \"startup\": {\"programs_ms\": %.3f, \"cold_programs_ms\": %.3f, \"warm_programs_ms\": %.3f, "
+           "\"program_cache_hits\": %d, \"program_cache_misses\": %d, \"parallel_compile\": %s, \"variants\": %d},\n",
+           startup_times.programs_ms, startup_times.cold_ms, startup_times.warm_ms,
+           startup_times.cache_hits, startup_times.cache_misses, startup_times.parallel_compile ? "true" : "false",
+           startup_times.variants);
+    printf("  \"frame_ms\": {\"min\": %.4f, \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f},\n",
+           frame_ms[0], sum / n, percentile(frame_ms, n, 50.0f), percentile(frame_ms, n, 95.0f),
+           percentile(frame_ms, n, 99.0f), frame_ms[n - 1]);
+    printf("  \"gpu_pass_ms\": {");
+    for (int p = 0; p < PASS_COUNT; ++p) {
+        const GpuTimer* timer = &gpu_timers[p];
+        printf("%s\"%s\": {\"mean\": %.4f, \"rolling\": %.4f, \"samples\": %d}", p ? ", " : "", pass_names[p],
+               timer->total_count ? timer->total_ms / timer->total_count : 0.0, gpu_timer_average_ms(p),
+               timer->total_count);
+    }
+    printf("},\n");
+    int frames = gl_state.total_frames ? gl_state.total_frames : 1;
+    long long issued = 0, elided = 0;
+    for (int k = 0; k < STATE_KIND_COUNT; ++k) {
+        issued += gl_state.total_issued[k];
+        elided += gl_state.total_elided[k];
+    }
+    printf("  \"gl_state\": {\"issued_per_frame\": %.1f, \"elided_per_frame\": %.1f, \"elided\": {",
+           (double)issued / frames, (double)elided / frames);
+    for (int k = 0; k < STATE_KIND_COUNT; ++k)
+        printf("%s\"%s\": %.1f", k ? ", " : "", state_kind_names[k], (double)gl_state.total_elided[k] / frames);
+    printf("}},\n");
+    printf("  \"draws\": {\"multi_draw_indirect\": %s, \"calls_per_frame\": %.1f, \"commands_per_frame\": %.1f},\n",
+           multi_draw_indirect ? "true" : "false", (double)gl_state.total_draw_calls / frames,
+           (double)gl_state.total_draw_commands / frames);
+    int cull_frames = cull_stats.total_frames ? cull_stats.total_frames : 1;
+    printf("  \"culling\": {\"enabled\": %s, \"gpu\": %s, \"bvh\": %s, \"occlusion\": \"%s\", \"objects\": %d, "
+           "\"main_visible_per_frame\": %.1f, \"late_visible_per_frame\": %.1f, \"shadow_visible_per_frame\": %.1f, "
+           "\"cull_ms\": %.4f}\n",
+           frustum_cull_enabled ? "true" : "false", cull_stats.gpu ? "true" : "false", bvh_enabled ? "true" : "false",
+           cull_stats.occlusion, cull_stats.objects,
+           (double)cull_stats.total_main_visible / cull_frames, (double)cull_stats.total_late_visible / cull_frames,
+           (double)cull_stats.total_shadow_visible / cull_frames, cull_stats.total_ms / cull_frames);
+    printf("}\n");
+}
+
+// Build boxes have no display: try GLFW's null platform with an EGL
+// (surfaceless) context, then OSMesa, then fall back to a hidden window.
+GLFWwindow* create_bench_window(void) {
+    const int apis[] = { GLFW_EGL_CONTEXT_API, GLFW_OSMESA_CONTEXT_API };
+    if (glfwPlatformSupported(GLFW_PLATFORM_NULL)) {
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+        for (int i = 0; i < 2; ++i) {
+            if (!glfwInit()) break;
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+            glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+            glfwWindowHint(GLFW_CONTEXT_CREATION_API, apis[i]);
+            glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+            GLFWwindow* window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "bench", NULL, NULL);
+            if (window) return window;
+            glfwTerminate();
+        }
+        glfwInitHint(GLFW_PLATFORM, GLFW_ANY_PLATFORM);
+    }
+    if (!glfwInit()) return NULL;
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    return glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "bench", NULL, NULL);
+}
+// --- End Benchmark Mode ---
 
 // Callback to adjust viewport on window resize
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
-    glViewport(0, 0, width, height);
+    gl_state_viewport(0, 0, width, height);
 }
 
 // Camera orbit variables
 float cam_yaw = 0.0f;    // left-right
 float cam_pitch = 30.0f; // up-down (degrees)
 float cam_dist = 12.0f;  // distance from center
+float cam_far = 50.0f;   // far plane, grown with the cube grid
+float scene_radius = 8.0f; // bounding sphere of the scene around the origin
 int mouse_down = 0;
 double last_mouse_x = 0, last_mouse_y = 0;
 
@@ -87,58 +622,703 @@ void cursor_position_callback(GLFWwindow* window, double xpos, double ypos) {
     }
 }
 
-// Shader loading utility
-char* load_file(const char* filename) {
-    FILE* f = fopen(filename, "rb");
-    if (!f) return NULL;
-    fseek(f, 0, SEEK_END);
-    long len = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    char* buf = (char*)malloc(len + 1);
-    fread(buf, 1, len, f);
-    buf[len] = 0;
-    fclose(f);
-    return buf;
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    if (key == GLFW_KEY_P && action == GLFW_PRESS)
+        shadow_quality = (shadow_quality + 1) % SHADOW_QUALITY_COUNT;
 }
 
-GLuint compile_shader(const char* path, GLenum type) {
-    char* src = load_file(path);
-    if (!src) { printf("Failed to load %s\n", path); exit(1); }
+// Submits a compile without waiting for it; see shader_compiled(). defines
+// (may be NULL) is inserted right after the #version line, followed by a
+// #line directive so compiler messages keep the file's line numbers.
+GLuint compile_shader(const char* src, const char* defines, GLenum type) {
     GLuint shader = glCreateShader(type);
-    glShaderSource(shader, 1, (const char**)&src, NULL);
+    const char* version_end = strchr(src, '\n');
+    if (defines && defines[0] && version_end && strncmp(src, "#version", 8) == 0) {
+        const char* parts[4] = { src, defines, "#line 2\n", version_end + 1 };
+        GLint lengths[4] = { (GLint)(version_end + 1 - src), -1, -1, -1 };
+        glShaderSource(shader, 4, parts, lengths);
+    } else {
+        glShaderSource(shader, 1, &src, NULL);
+    }
     glCompileShader(shader);
+    return shader;
+}
+
+// Blocks until the compile is done; prints the log on failure
+int shader_compiled(GLuint shader, const char* path) {
     int success;
     glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
     if (!success) {
         char info[512];
         glGetShaderInfoLog(shader, 512, NULL, info);
         printf("Shader compile error (%s): %s\n", path, info);
-        exit(1);
     }
-    free(src);
-    return shader;
+    return success;
+}
+
+// --- Per-Frame Uniform Block ---
+// Mirrors the std140 FrameData block declared in vertex_shader.glsl,
+// fragment_shader.glsl and depth_vertex_shader.glsl. vec3 members are padded
+// to 16 bytes as std140 requires.
+#define FRAME_UBO_BINDING 0
+typedef struct {
+    float view[16];
+    float projection[16];
+    float lightSpaceMatrices[MAX_CASCADES][16];
+    float cascadeSplits[MAX_CASCADES]; // View-space far distance of each cascade
+    float lightDir[3]; int cascadeCount;
+    float viewPos[3];  float pad1;
+} FrameUniforms;
+
+// Binds the program's FrameData block (if it uses one) to FRAME_UBO_BINDING
+void bind_frame_block(GLuint prog) {
+    GLuint index = glGetUniformBlockIndex(prog, "FrameData");
+    if (index == GL_INVALID_INDEX) return;
+    GLint size = 0;
+    glGetActiveUniformBlockiv(prog, index, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+    if (size != (GLint)sizeof(FrameUniforms))
+        printf("FrameData block is %d bytes, expected %d\n", size, (int)sizeof(FrameUniforms));
+    glUniformBlockBinding(prog, index, FRAME_UBO_BINDING);
+}
+// --- End Per-Frame Uniform Block ---
+
+// --- Cascaded Shadow Maps ---
+// The camera frustum is split along view depth and each slice gets its own
+// orthographic light projection fitted around the slice's bounding sphere.
+// Spheres keep the projection size fixed as the camera turns, and the center
+// is snapped to whole shadow texels so edges do not shimmer while it moves.
+#define CASCADE_SPLIT_LAMBDA 0.6f // 0 = uniform splits, 1 = logarithmic
+
+// Fills lightSpaceMatrices, cascadeSplits and cascadeCount in fu. Splits
+// cover the part of [znear, zfar] that can contain the scene's bounding sphere.
+void compute_cascades(FrameUniforms* fu, const float* eye, const float* center, float fov, float aspect,
+                      float znear, float zfar) {
+    float forward[3] = { center[0] - eye[0], center[1] - eye[1], center[2] - eye[2] };
+    vec3_normalize(forward);
+    float right[3], up[3];
+    vec3_cross(right, forward, (float[3]){ 0.0f, 1.0f, 0.0f });
+    vec3_normalize(right);
+    vec3_cross(up, right, forward);
+
+    float eye_dist = sqrtf(vec3_dot(eye, eye));
+    float first = eye_dist - scene_radius > znear ? eye_dist - scene_radius : znear;
+    float last = eye_dist + scene_radius < zfar ? eye_dist + scene_radius : zfar;
+    if (last <= first) last = first + 1.0f;
+
+    // Fixed light orientation; only the ortho bounds move per cascade
+    float lightView[16];
+    mat4_lookAt(lightView, (float[3]){ 0.0f, 0.0f, 0.0f }, fu->lightDir, (float[3]){ 0.0f, 1.0f, 0.0f });
+
+    float tan_y = tanf(fov * 0.5f), tan_x = tan_y * aspect;
+    float slice_near = znear;
+    fu->cascadeCount = shadow_cascades;
+    for (int c = 0; c < shadow_cascades; ++c) {
+        // Practical split scheme: blend of uniform and logarithmic
+        float p = (float)(c + 1) / shadow_cascades;
+        float split_log = first * powf(last / first, p);
+        float split_uni = first + (last - first) * p;
+        float slice_far = CASCADE_SPLIT_LAMBDA * split_log + (1.0f - CASCADE_SPLIT_LAMBDA) * split_uni;
+        fu->cascadeSplits[c] = slice_far;
+
+        // Bounding sphere of the slice's eight corners
+        float corners[8][3], mid[3] = { 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 8; ++i) {
+            float d = (i & 4) ? slice_far : slice_near;
+            float sx = ((i & 1) ? 1.0f : -1.0f) * tan_x * d;
+            float sy = ((i & 2) ? 1.0f : -1.0f) * tan_y * d;
+            for (int k = 0; k < 3; ++k) {
+                corners[i][k] = eye[k] + forward[k] * d + right[k] * sx + up[k] * sy;
+                mid[k] += corners[i][k] * 0.125f;
+            }
+        }
+        float radius = 0.0f;
+        for (int i = 0; i < 8; ++i) {
+            float dx = corners[i][0] - mid[0], dy = corners[i][1] - mid[1], dz = corners[i][2] - mid[2];
+            float r = sqrtf(dx * dx + dy * dy + dz * dz);
+            if (r > radius) radius = r;
+        }
+        radius = ceilf(radius * 16.0f) / 16.0f; // Quantized so the texel size is stable
+
+        // Snap the sphere center (in light space) to the texel grid
+        float texel = 2.0f * radius / shadow_size;
+        float lx = lightView[0] * mid[0] + lightView[4] * mid[1] + lightView[8] * mid[2];
+        float ly = lightView[1] * mid[0] + lightView[5] * mid[1] + lightView[9] * mid[2];
+        float lz = lightView[2] * mid[0] + lightView[6] * mid[1] + lightView[10] * mid[2];
+        lx = floorf(lx / texel) * texel;
+        ly = floorf(ly / texel) * texel;
+        // Depth range starts at the near side of the scene so every caster
+        // between the light and the slice lands in the map
+        float near_plane = -scene_radius, far_plane = -lz + radius;
+        if (far_plane < near_plane + 1.0f) far_plane = near_plane + 1.0f;
+        float lightProjection[16];
+        mat4_ortho(lightProjection, lx - radius, lx + radius, ly - radius, ly + radius, near_plane, far_plane);
+        // mat4_multiply(out, a, b) is b * a in column-vector terms
+        mat4_multiply(fu->lightSpaceMatrices[c], lightView, lightProjection);
+        slice_near = slice_far;
+    }
+}
+// --- End Cascaded Shadow Maps ---
+
+// --- Shader Program Reflection ---
+// create_program() reflects every active uniform once at link time into an
+// open-addressed hash table keyed by name, so per-frame code never calls
+// glGetUniformLocation. The typed setters also remember the last value
+// uploaded and skip the glUniform* call when it has not changed. Attribute
+// locations are fixed with layout(location) in the shaders, so they are not
+// reflected.
+#define PROGRAM_UNIFORM_SLOTS 64 // Power of two, comfortably above the active uniform count
+#define PROGRAM_NAME_LEN 64
+
+typedef struct {
+    char name[PROGRAM_NAME_LEN]; // Empty = free slot; arrays are stored without "[0]"
+    GLint location;
+    GLenum type;
+    GLint size;
+    int has_value;
+    float value[16];             // Last uploaded value (ints are stored bitwise)
+} UniformInfo;
+
+typedef struct {
+    GLuint id;
+    UniformInfo uniforms[PROGRAM_UNIFORM_SLOTS];
+    int uniform_count;
+    // Set by create_program(), consumed by program_finish()
+    int linked;           // Link checked and program reflected
+    GLuint vs, fs;        // Shaders still attached (0 when loaded from a binary)
+    const char* vs_path;
+    const char* fs_path;
+    char defines[192];    // Permutation #defines, see compile_shader()
+    int store_binary;     // Save to cache_path once linked
+    char cache_path[256];
+} Program;
+
+// FNV-1a
+unsigned int hash_name(const char* name) {
+    unsigned int h = 2166136261u;
+    while (*name) { h ^= (unsigned char)*name++; h *= 16777619u; }
+    return h;
+}
+
+// Returns the slot holding name, or the free slot where it would go
+UniformInfo* program_uniform_slot(Program* prog, const char* name) {
+    unsigned int i = hash_name(name) & (PROGRAM_UNIFORM_SLOTS - 1);
+    while (prog->uniforms[i].name[0] && strcmp(prog->uniforms[i].name, name) != 0)
+        i = (i + 1) & (PROGRAM_UNIFORM_SLOTS - 1);
+    return &prog->uniforms[i];
+}
+
+// NULL when the uniform is not active (optimized out or not declared)
+UniformInfo* program_uniform(Program* prog, const char* name) {
+    UniformInfo* u = program_uniform_slot(prog, name);
+    return u->name[0] ? u : NULL;
+}
+
+void program_reflect(Program* prog) {
+    memset(prog->uniforms, 0, sizeof(prog->uniforms));
+    prog->uniform_count = 0;
+
+    GLint count = 0;
+    char name[PROGRAM_NAME_LEN];
+    glGetProgramiv(prog->id, GL_ACTIVE_UNIFORMS, &count);
+    for (GLint i = 0; i < count; ++i) {
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(prog->id, i, sizeof(name), NULL, &size, &type, name);
+        GLint location = glGetUniformLocation(prog->id, name);
+        if (location == -1) continue; // Uniform block members have no location
+        char* bracket = strstr(name, "[0]");
+        if (bracket) *bracket = 0;
+        if (prog->uniform_count >= PROGRAM_UNIFORM_SLOTS / 2) {
+            printf("Too many active uniforms, %s not cached\n", name);
+            continue;
+        }
+        UniformInfo* u = program_uniform_slot(prog, name);
+        strcpy(u->name, name);
+        u->location = location;
+        u->type = type;
+        u->size = size;
+        prog->uniform_count++;
+    }
 }
 
-GLuint create_program(const char* vs_path, const char* fs_path) {
-    GLuint vs = compile_shader(vs_path, GL_VERTEX_SHADER);
-    GLuint fs = compile_shader(fs_path, GL_FRAGMENT_SHADER);
-    GLuint prog = glCreateProgram();
-    glAttachShader(prog, vs);
-    glAttachShader(prog, fs);
-    glLinkProgram(prog);
+// Returns the uniform when value differs from what was last uploaded
+UniformInfo* uniform_if_changed(Program* prog, const char* name, const void* value, size_t bytes) {
+    UniformInfo* u = program_uniform(prog, name);
+    if (!u) return NULL;
+    if (!gl_state_count(STATE_UNIFORM, !u->has_value || memcmp(u->value, value, bytes) != 0)) return NULL;
+    memcpy(u->value, value, bytes);
+    u->has_value = 1;
+    return u;
+}
+
+// Setters act on the current program, like glUniform*
+void program_set_int(Program* prog, const char* name, int value) {
+    UniformInfo* u = uniform_if_changed(prog, name, &value, sizeof(value));
+    if (u) glUniform1i(u->location, value);
+}
+
+void program_set_mat4(Program* prog, const char* name, const float* value) {
+    UniformInfo* u = uniform_if_changed(prog, name, value, 16 * sizeof(float));
+    if (u) glUniformMatrix4fv(u->location, 1, GL_FALSE, value);
+}
+
+// --- Program Binary Cache ---
+// Linked programs are saved with glGetProgramBinary under PROGRAM_CACHE_DIR
+// and reloaded with glProgramBinary on the next launch. The file name is a
+// hash of both shader sources, the variant's defines and the driver's vendor/renderer/version, so
+// editing a shader or updating the driver misses the cache. A binary the
+// driver rejects falls back to compiling from source and is rewritten.
+// Needs GL 4.1 (or a driver exposing at least one binary format).
+#define PROGRAM_CACHE_DIR "shader_cache"
+#define PROGRAM_CACHE_MAGIC 0x42504C47u // "GLPB"
+int program_cache_enabled = 1;
+int program_cache_hits = 0, program_cache_misses = 0;
+double program_load_ms = 0.0; // Time spent in create_program
+
+unsigned long long hash_string64(unsigned long long h, const char* s) {
+    while (*s) { h ^= (unsigned char)*s++; h *= 1099511628211ull; }
+    return h;
+}
+
+int program_cache_supported(void) {
+    if (!glGetProgramBinary || !glProgramBinary || !glProgramParameteri) return 0;
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+void program_cache_path(char* out, size_t size, const char* vs_src, const char* fs_src, const char* defines) {
+    unsigned long long h = 14695981039346656037ull;
+    h = hash_string64(h, vs_src);
+    h = hash_string64(h, fs_src);
+    h = hash_string64(h, defines);
+    h = hash_string64(h, (const char*)glGetString(GL_VENDOR));
+    h = hash_string64(h, (const char*)glGetString(GL_RENDERER));
+    h = hash_string64(h, (const char*)glGetString(GL_VERSION));
+    snprintf(out, size, PROGRAM_CACHE_DIR "/%016llx.bin", h);
+}
+
+// Returns a linked program, or 0 if there is no usable binary at path
+GLuint program_cache_load(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return 0;
+    unsigned int header[3]; // magic, binary format, length
+    GLuint id = 0;
+    if (fread(header, sizeof(header), 1, f) == 1 && header[0] == PROGRAM_CACHE_MAGIC) {
+        void* binary = malloc(header[2]);
+        if (binary && fread(binary, 1, header[2], f) == header[2]) {
+            id = glCreateProgram();
+            glProgramBinary(id, (GLenum)header[1], binary, (GLsizei)header[2]);
+            int success;
+            glGetProgramiv(id, GL_LINK_STATUS, &success);
+            if (!success) { glDeleteProgram(id); id = 0; }
+        }
+        free(binary);
+    }
+    fclose(f);
+    return id;
+}
+
+void program_cache_store(GLuint id, const char* path) {
+    GLint length = 0;
+    glGetProgramiv(id, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return;
+    void* binary = malloc(length);
+    GLenum format;
+    glGetProgramBinary(id, length, &length, &format, binary);
+#ifdef _WIN32
+    _mkdir(PROGRAM_CACHE_DIR);
+#else
+    mkdir(PROGRAM_CACHE_DIR, 0755);
+#endif
+    FILE* f = fopen(path, "wb");
+    if (f) {
+        unsigned int header[3] = { PROGRAM_CACHE_MAGIC, (unsigned int)format, (unsigned int)length };
+        fwrite(header, sizeof(header), 1, f);
+        fwrite(binary, 1, length, f);
+        fclose(f);
+    }
+    free(binary);
+}
+// --- End Program Binary Cache ---
+
+// --- Asynchronous Program Creation ---
+// create_program() only submits work: it issues both compiles and the link
+// and returns without reading any status, so the driver can build every
+// program in parallel (GL_KHR_parallel_shader_compile) or at least overlap
+// the work with the rest of startup. program_finish() checks the result,
+// reflects the program and stores its binary; program_use() calls it the
+// first time the program is bound, and program_poll() says whether that
+// would block.
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+typedef void (GLAD_API_PTR *PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+int parallel_compile = 0; // GL_KHR/ARB_parallel_shader_compile available
+
+void parallel_compile_init(void) {
+    PFNGLMAXSHADERCOMPILERTHREADSKHRPROC max_threads = NULL;
+    if (glfwExtensionSupported("GL_KHR_parallel_shader_compile"))
+        max_threads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+    else if (glfwExtensionSupported("GL_ARB_parallel_shader_compile"))
+        max_threads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+    if (!max_threads) return;
+    max_threads(0xFFFFFFFFu); // Let the driver pick the thread count
+    parallel_compile = 1;
+}
+
+// defines (may be NULL) is prepended to both shaders, see compile_shader().
+// With fs_path NULL, vs_path is a compute shader (GL 4.3).
+Program* create_program(const char* vs_path, const char* fs_path, const char* defines) {
+    double start = glfwGetTime();
+    char* vs_src = load_file(vs_path);
+    if (!vs_src) { printf("Failed to load %s\n", vs_path); exit(1); }
+    char* fs_src = fs_path ? load_file(fs_path) : calloc(1, 1);
+    if (!fs_src) { printf("Failed to load %s\n", fs_path); exit(1); }
+
+    Program* prog = (Program*)calloc(1, sizeof(Program));
+    prog->vs_path = vs_path;
+    prog->fs_path = fs_path;
+    snprintf(prog->defines, sizeof(prog->defines), "%s", defines ? defines : "");
+    int use_cache = program_cache_enabled && program_cache_supported();
+    if (use_cache) {
+        program_cache_path(prog->cache_path, sizeof(prog->cache_path), vs_src, fs_src, prog->defines);
+        prog->id = program_cache_load(prog->cache_path);
+    }
+    if (prog->id) {
+        program_cache_hits++;
+    } else {
+        prog->vs = compile_shader(vs_src, prog->defines, fs_path ? GL_VERTEX_SHADER : GL_COMPUTE_SHADER);
+        if (fs_path) prog->fs = compile_shader(fs_src, prog->defines, GL_FRAGMENT_SHADER);
+        prog->id = glCreateProgram();
+        if (use_cache) glProgramParameteri(prog->id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glAttachShader(prog->id, prog->vs);
+        if (prog->fs) glAttachShader(prog->id, prog->fs);
+        glLinkProgram(prog->id);
+        prog->store_binary = use_cache;
+        if (use_cache) program_cache_misses++;
+    }
+    free(vs_src);
+    free(fs_src);
+    program_load_ms += (glfwGetTime() - start) * 1000.0;
+    return prog;
+}
+
+// 1 if program_finish() would return without waiting on the driver. Without
+// the parallel compile extension there is no way to ask, so it reports 1.
+int program_poll(const Program* prog) {
+    if (prog->linked || !parallel_compile) return 1;
+    GLint done = 0;
+    glGetProgramiv(prog->id, GL_COMPLETION_STATUS_KHR, &done);
+    return done;
+}
+
+// Waits for the link, then reflects the program and caches its binary.
+// Returns 0 (after printing the logs) if compiling or linking failed.
+int program_try_finish(Program* prog) {
+    if (prog->linked) return 1;
+    double start = glfwGetTime();
     int success;
-    glGetProgramiv(prog, GL_LINK_STATUS, &success);
+    glGetProgramiv(prog->id, GL_LINK_STATUS, &success);
     if (!success) {
-        char info[512];
-        glGetProgramInfoLog(prog, 512, NULL, info);
-        printf("Program link error: %s\n", info);
-        exit(1);
+        if (prog->vs && shader_compiled(prog->vs, prog->vs_path) &&
+            (!prog->fs || shader_compiled(prog->fs, prog->fs_path))) {
+            char info[512];
+            glGetProgramInfoLog(prog->id, 512, NULL, info);
+            printf("Program link error: %s\n", info);
+        }
+        return 0;
+    }
+    if (prog->vs) {
+        glDetachShader(prog->id, prog->vs);
+        glDeleteShader(prog->vs);
+    }
+    if (prog->fs) {
+        glDetachShader(prog->id, prog->fs);
+        glDeleteShader(prog->fs);
+    }
+    prog->vs = prog->fs = 0;
+    if (prog->store_binary) program_cache_store(prog->id, prog->cache_path);
+    bind_frame_block(prog->id);
+    program_reflect(prog);
+    prog->linked = 1;
+    program_load_ms += (glfwGetTime() - start) * 1000.0;
+    return 1;
+}
+
+void program_finish(Program* prog) {
+    if (!program_try_finish(prog)) exit(1);
+}
+
+void program_use(Program* prog) {
+    program_finish(prog);
+    gl_state_use_program(prog->id);
+}
+// --- End Asynchronous Program Creation ---
+
+void delete_program(Program* prog) {
+    if (prog->vs) glDeleteShader(prog->vs);
+    if (prog->fs) glDeleteShader(prog->fs);
+    glDeleteProgram(prog->id);
+    // The name can be handed out again, so the cache must not match it
+    if (gl_state.program == prog->id) gl_state.program = STATE_UNKNOWN;
+    free(prog);
+}
+
+// --- Shader Hot Reload ---
+// Interactive runs watch the shader files of every registered program. On
+// Linux an inotify watch on the working directory reports writes and renames
+// (editors often save by renaming a temp file); elsewhere the files' mtimes
+// are polled. A change submits a new build of the program, which is polled
+// each frame and swapped into the existing Program only once it links, so a
+// typo keeps the old shader running. Callers keep their Program pointers;
+// the swapped-in program is freshly reflected, so every cached uniform is
+// re-uploaded by the next setter call. Compute programs (no fs_path) are
+// watched the same way.
+#define HOT_RELOAD_POLL_SECONDS 0.5
+
+typedef struct {
+    Program* prog;
+    Program* pending; // Rebuild in flight, swapped in once it links
+    int dirty;        // A source changed; rebuild when nothing is pending
+    time_t vs_mtime, fs_mtime;
+} WatchedProgram;
+
+WatchedProgram* watched_programs; // Grows as variants are built
+int watched_count = 0;
+int watched_capacity = 0;
+int inotify_fd = -1;
+double next_mtime_poll = 0.0;
+
+time_t file_mtime(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_mtime : 0;
+}
+
+void hot_reload_init(void) {
+#ifdef __linux__
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd >= 0 && inotify_add_watch(inotify_fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+#endif
+}
+
+void hot_reload_watch(Program* prog) {
+    if (watched_count == watched_capacity) {
+        int capacity = watched_capacity ? watched_capacity * 2 : 16;
+        WatchedProgram* grown = (WatchedProgram*)realloc(watched_programs, capacity * sizeof(WatchedProgram));
+        if (!grown) {
+            printf("Hot reload: out of memory, %s will not be reloaded\n", prog->vs_path);
+            return;
+        }
+        watched_programs = grown;
+        watched_capacity = capacity;
+    }
+    WatchedProgram* w = &watched_programs[watched_count++];
+    memset(w, 0, sizeof(*w));
+    w->prog = prog;
+    w->vs_mtime = file_mtime(prog->vs_path);
+    w->fs_mtime = prog->fs_path ? file_mtime(prog->fs_path) : 0;
+}
+
+void hot_reload_mark(const char* file) {
+    for (int i = 0; i < watched_count; ++i) {
+        WatchedProgram* w = &watched_programs[i];
+        if (strcmp(w->prog->vs_path, file) == 0 || (w->prog->fs_path && strcmp(w->prog->fs_path, file) == 0))
+            w->dirty = 1;
+    }
+}
+
+// Marks programs whose sources changed since the last call
+void hot_reload_scan(void) {
+#ifdef __linux__
+    if (inotify_fd >= 0) {
+        _Alignas(struct inotify_event) char buf[4096];
+        ssize_t len;
+        while ((len = read(inotify_fd, buf, sizeof(buf))) > 0) {
+            for (char* p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+                struct inotify_event* ev = (struct inotify_event*)p;
+                if (ev->len) hot_reload_mark(ev->name);
+            }
+        }
+        return;
+    }
+#endif
+    double now = glfwGetTime();
+    if (now < next_mtime_poll) return;
+    next_mtime_poll = now + HOT_RELOAD_POLL_SECONDS;
+    for (int i = 0; i < watched_count; ++i) {
+        WatchedProgram* w = &watched_programs[i];
+        time_t vs = file_mtime(w->prog->vs_path), fs = w->prog->fs_path ? file_mtime(w->prog->fs_path) : 0;
+        if (vs != w->vs_mtime || fs != w->fs_mtime) w->dirty = 1;
+        w->vs_mtime = vs;
+        w->fs_mtime = fs;
+    }
+}
+
+// Call once per frame, outside any pass
+void hot_reload_update(void) {
+    hot_reload_scan();
+    for (int i = 0; i < watched_count; ++i) {
+        WatchedProgram* w = &watched_programs[i];
+        if (!w->pending && w->dirty) {
+            w->dirty = 0;
+            w->pending = create_program(w->prog->vs_path, w->prog->fs_path, w->prog->defines);
+        }
+        if (!w->pending || !program_poll(w->pending)) continue;
+        if (program_try_finish(w->pending)) {
+            glDeleteProgram(w->prog->id);
+            *w->prog = *w->pending;
+            free(w->pending);
+            printf("Reloaded %s%s%s\n", w->prog->vs_path, w->prog->fs_path ? " + " : "",
+                   w->prog->fs_path ? w->prog->fs_path : "");
+        } else {
+            delete_program(w->pending);
+            printf("Reload of %s%s%s failed, keeping the previous program\n", w->prog->vs_path,
+                   w->prog->fs_path ? " + " : "", w->prog->fs_path ? w->prog->fs_path : "");
+        }
+        w->pending = NULL;
+    }
+}
+
+void hot_reload_cleanup(void) {
+    for (int i = 0; i < watched_count; ++i)
+        if (watched_programs[i].pending) delete_program(watched_programs[i].pending);
+    free(watched_programs);
+    watched_programs = NULL;
+    watched_count = watched_capacity = 0;
+#ifdef __linux__
+    if (inotify_fd >= 0) close(inotify_fd);
+    inotify_fd = -1;
+#endif
+}
+// --- End Shader Hot Reload ---
+// --- End Shader Program Reflection ---
+
+// --- Shader Permutations ---
+// Features that used to be per-fragment uniform branches are compile-time
+// #defines. A ShaderFamily is one vertex/fragment source pair plus every
+// variant built from it so far, indexed by a permutation key; variants are
+// created on first use (or up front by shader_family_prewarm). Uniforms that
+// are the same for every variant in a pass (sampler units, the cascade index)
+// are set on the family and pushed to whichever variant gets bound, where
+// the uniform cache drops the ones that did not change.
+#define PERM_USE_TEXTURE     (1u << 0) // Sample texture1 instead of the instance color
+#define PERM_RECEIVE_SHADOWS (1u << 1) // Run the shadow lookup at all
+#define PERM_TAPS_SHIFT      2         // Bits 2-3: shadow_quality tier
+#define PERM_INSTANCE_FETCH  (1u << 4) // Instances come from the GPU culling index buffer
+#define PERM_SHADER_NORMAL_MATRIX (1u << 5) // Per-vertex transpose(inverse(model)), for A/B runs
+#define PERM_KEY_COUNT       64
+#define FAMILY_MAX_UNIFORMS  8
+const int shadow_taps[SHADOW_QUALITY_COUNT] = { 1, 4, 9, 16 }; // 16 = Poisson disk
+
+typedef struct {
+    const char* vs_path;
+    const char* fs_path;
+    unsigned perm_mask;                  // Key bits the sources respond to
+    int id;                              // Small unique number, used in render queue sort keys
+    Program* variants[PERM_KEY_COUNT];
+    struct { const char* name; int value; } ints[FAMILY_MAX_UNIFORMS];
+    int int_count;
+} ShaderFamily;
+
+unsigned perm_shadow_key(int quality) {
+    return PERM_RECEIVE_SHADOWS | ((unsigned)quality << PERM_TAPS_SHIFT);
+}
+
+void perm_defines(char* out, size_t size, unsigned key) {
+    snprintf(out, size,
+             "#define USE_TEXTURE %d\n#define RECEIVE_SHADOWS %d\n#define SHADOW_TAPS %d\n#define INSTANCE_FETCH %d\n"
+             "#define SHADER_NORMAL_MATRIX %d\n",
+             (key & PERM_USE_TEXTURE) ? 1 : 0, (key & PERM_RECEIVE_SHADOWS) ? 1 : 0,
+             shadow_taps[(key >> PERM_TAPS_SHIFT) & 3], (key & PERM_INSTANCE_FETCH) ? 1 : 0,
+             (key & PERM_SHADER_NORMAL_MATRIX) ? 1 : 0);
+}
+
+// Submits the variant for key if it does not exist yet
+Program* shader_family_variant(ShaderFamily* fam, unsigned key) {
+    key &= fam->perm_mask;
+    if (!fam->variants[key]) {
+        char defines[192] = "";
+        if (fam->perm_mask) perm_defines(defines, sizeof(defines), key);
+        fam->variants[key] = create_program(fam->vs_path, fam->fs_path, defines);
+        if (!headless) hot_reload_watch(fam->variants[key]);
+    }
+    return fam->variants[key];
+}
+
+// Starts compiling variants that are about to be needed so they build in parallel
+void shader_family_prewarm(ShaderFamily* fam, const unsigned* keys, int n) {
+    for (int i = 0; i < n; ++i) shader_family_variant(fam, keys[i]);
+}
+
+void shader_family_set_int(ShaderFamily* fam, const char* name, int value) {
+    for (int i = 0; i < fam->int_count; ++i) {
+        if (strcmp(fam->ints[i].name, name) == 0) { fam->ints[i].value = value; return; }
     }
-    glDeleteShader(vs);
-    glDeleteShader(fs);
+    if (fam->int_count == FAMILY_MAX_UNIFORMS) return;
+    fam->ints[fam->int_count].name = name;
+    fam->ints[fam->int_count].value = value;
+    fam->int_count++;
+}
+
+// Binds the variant for key and applies the family's shared uniforms
+Program* shader_family_use(ShaderFamily* fam, unsigned key) {
+    Program* prog = shader_family_variant(fam, key);
+    program_use(prog);
+    for (int i = 0; i < fam->int_count; ++i) program_set_int(prog, fam->ints[i].name, fam->ints[i].value);
     return prog;
 }
 
+int shader_family_variant_count(const ShaderFamily* fam) {
+    int n = 0;
+    for (int i = 0; i < PERM_KEY_COUNT; ++i) n += fam->variants[i] != NULL;
+    return n;
+}
+
+// Creates and deletes every variant the run has built, once from source and
+// once from the binary cache. The launch stored those same variants (same
+// defines, so the same cache files), so the warm pass only misses when the
+// cache could not be written. Drivers with their own shader cache (e.g.
+// Mesa) make the cold figure optimistic.
+void measure_program_startup(StartupTimes* times, ShaderFamily* const* families, int familyCount) {
+    int enabled = program_cache_enabled;
+    for (int pass = 0; pass < 2; ++pass) {
+        program_cache_enabled = pass == 1;
+        if (pass == 1 && !(enabled && program_cache_supported())) { times->warm_ms = -1.0; break; }
+        double start = glfwGetTime();
+        Program* progs[2 * PERM_KEY_COUNT];
+        int n = 0;
+        for (int f = 0; f < familyCount; ++f) {
+            const ShaderFamily* fam = families[f];
+            for (unsigned key = 0; key < PERM_KEY_COUNT && n < 2 * PERM_KEY_COUNT; ++key) {
+                if (!fam->variants[key]) continue;
+                char defines[192] = "";
+                if (fam->perm_mask) perm_defines(defines, sizeof(defines), key);
+                progs[n++] = create_program(fam->vs_path, fam->fs_path, defines);
+            }
+        }
+        for (int i = 0; i < n; ++i) {
+            program_finish(progs[i]);
+            delete_program(progs[i]);
+        }
+        double ms = (glfwGetTime() - start) * 1000.0;
+        if (pass == 0) times->cold_ms = ms;
+        else times->warm_ms = ms;
+    }
+    program_cache_enabled = enabled;
+}
+
+// Call after hot_reload_cleanup(), which may still hold pending rebuilds
+void shader_family_cleanup(ShaderFamily* fam) {
+    for (int i = 0; i < PERM_KEY_COUNT; ++i) {
+        if (fam->variants[i]) delete_program(fam->variants[i]);
+        fam->variants[i] = NULL;
+    }
+}
+// --- End Shader Permutations ---
+
 // Cube vertex data (positions, normals, texcoords)
 float cube_vertices[] = {
     // positions        // normals         // texcoords
@@ -182,189 +1362,984 @@ unsigned int cube_indices[] = {
     20,21,22, 22,23,20 // left
 };
 
-// Sphere mesh generation (positions, normals, texcoords, indices)
-#define SPHERE_LAT 16
-#define SPHERE_LON 32
-float sphere_vertices[(SPHERE_LAT+1)*(SPHERE_LON+1)*8];
-unsigned int sphere_indices[SPHERE_LAT*SPHERE_LON*6];
-void generate_sphere_mesh() {
-    int v = 0;
-    for (int i = 0; i <= SPHERE_LAT; ++i) {
-        float lat = (float)i / SPHERE_LAT * 3.1415926f;
-        float y = cosf(lat);
-        float r = sinf(lat);
-        for (int j = 0; j <= SPHERE_LON; ++j) {
-            float lon = (float)j / SPHERE_LON * 2.0f * 3.1415926f;
-            float x = r * cosf(lon);
-            float z = r * sinf(lon);
-            // Position
-            sphere_vertices[v++] = x * 0.4f;
-            sphere_vertices[v++] = y * 0.4f;
-            sphere_vertices[v++] = z * 0.4f;
-            // Normal
-            sphere_vertices[v++] = x;
-            sphere_vertices[v++] = y;
-            sphere_vertices[v++] = z;
-            // Texcoord
-            sphere_vertices[v++] = (float)j / SPHERE_LON;
-            sphere_vertices[v++] = (float)i / SPHERE_LAT;
-        }
-    }
-    int idx = 0;
-    for (int i = 0; i < SPHERE_LAT; ++i) {
-        for (int j = 0; j < SPHERE_LON; ++j) {
-            int first = i * (SPHERE_LON + 1) + j;
-            int second = first + SPHERE_LON + 1;
-            sphere_indices[idx++] = first;
-            sphere_indices[idx++] = second;
-            sphere_indices[idx++] = first + 1;
-            sphere_indices[idx++] = second;
-            sphere_indices[idx++] = second + 1;
-            sphere_indices[idx++] = first + 1;
-        }
-    }
-}
-
-// --- Matrix Helper Functions ---
-void mat4_identity(float* m) {
-    memset(m, 0, 16 * sizeof(float));
-    m[0] = m[5] = m[10] = m[15] = 1.0f;
-}
-
-void vec3_cross(float* out, const float* a, const float* b) {
-    out[0] = a[1] * b[2] - a[2] * b[1];
-    out[1] = a[2] * b[0] - a[0] * b[2];
-    out[2] = a[0] * b[1] - a[1] * b[0];
-}
-
-float vec3_dot(const float* a, const float* b) {
-    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
-}
-
-void vec3_normalize(float* v) {
-    float len = sqrtf(vec3_dot(v, v));
-    if (len > 1e-6f) {
-        v[0] /= len;
-        v[1] /= len;
-        v[2] /= len;
-    }
-}
-
-void mat4_lookAt(float* out, const float* eye, const float* center, const float* up) {
-    float f[3], s[3], u[3];
-    f[0] = center[0] - eye[0]; f[1] = center[1] - eye[1]; f[2] = center[2] - eye[2];
-    vec3_normalize(f);
-    vec3_cross(s, f, up);
-    vec3_normalize(s);
-    vec3_cross(u, s, f); // No need to normalize u if s and f are orthonormal
-
-    mat4_identity(out);
-    out[0] = s[0];  out[4] = s[1];  out[8] = s[2];
-    out[1] = u[0];  out[5] = u[1];  out[9] = u[2];
-    out[2] = -f[0]; out[6] = -f[1]; out[10] = -f[2];
-    out[12] = -vec3_dot(s, eye);
-    out[13] = -vec3_dot(u, eye);
-    out[14] = vec3_dot(f, eye);
-}
-
-void mat4_ortho(float* out, float left, float right, float bottom, float top, float nearVal, float farVal) {
-    mat4_identity(out);
-    out[0] = 2.0f / (right - left);
-    out[5] = 2.0f / (top - bottom);
-    out[10] = -2.0f / (farVal - nearVal);
-    out[12] = -(right + left) / (right - left);
-    out[13] = -(top + bottom) / (top - bottom);
-    out[14] = -(farVal + nearVal) / (farVal - nearVal);
-}
-
-void mat4_perspective(float* out, float fovy, float aspect, float nearVal, float farVal) {
-    float f = 1.0f / tanf(fovy / 2.0f);
-    mat4_identity(out);
-    out[0] = f / aspect;
-    out[5] = f;
-    out[10] = (farVal + nearVal) / (nearVal - farVal);
-    out[11] = -1.0f;
-    out[14] = (2.0f * farVal * nearVal) / (nearVal - farVal);
-    out[15] = 0.0f; // Important: Set w to 0 for perspective projection
-}
-
-void mat4_multiply(float* out, const float* a, const float* b) {
-    float temp[16];
-    for (int i = 0; i < 4; ++i) { // row
-        for (int j = 0; j < 4; ++j) { // col
-            temp[i * 4 + j] = 0.0f;
-            for (int k = 0; k < 4; ++k) {
-                temp[i * 4 + j] += a[i * 4 + k] * b[k * 4 + j];
-            }
+// Sphere tessellation defaults to 16x32; --sphere LATxLON raises it for vertex-bound benchmarks
+int sphere_lat = 16;
+int sphere_lon = 32;
+
+// --- Instance Data ---
+// Per-instance attributes read by vertex_shader.glsl and depth_vertex_shader.glsl
+typedef struct {
+    float model[16];  // locations 3-6 (one vec4 column each)
+    float color[3];   // location 7
+    float normal[9];  // locations 8-10: inverse-transpose of the model's upper 3x3
+} InstanceData;
+
+// Points the per-instance attributes of the bound VAO at instanceVBO,
+// starting at instance firstInstance
+void setup_instance_attributes(GLuint instanceVBO, int firstInstance) {
+    size_t base = (size_t)firstInstance * sizeof(InstanceData);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    for (int c = 0; c < 4; ++c) {
+        glVertexAttribPointer(3 + c, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                              (void*)(base + c * 4 * sizeof(float)));
+        glEnableVertexAttribArray(3 + c);
+        glVertexAttribDivisor(3 + c, 1);
+    }
+    glVertexAttribPointer(7, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                          (void*)(base + offsetof(InstanceData, color)));
+    glEnableVertexAttribArray(7);
+    glVertexAttribDivisor(7, 1);
+    for (int c = 0; c < 3; ++c) {
+        glVertexAttribPointer(8 + c, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                              (void*)(base + offsetof(InstanceData, normal) + c * 3 * sizeof(float)));
+        glEnableVertexAttribArray(8 + c);
+        glVertexAttribDivisor(8 + c, 1);
+    }
+}
+
+// Every instance lives in one buffer: the sphere first (rewritten each
+// frame), then the cube grid
+#define SPHERE_INSTANCE     0
+#define CUBE_FIRST_INSTANCE 1
+enum { SPHERE_BATCH, CUBE_BATCH }; // GPU culling batches, in the same order
+// --- End Instance Data ---
+
+// --- Mesh Buffer ---
+// All static meshes share one vertex buffer (8 floats per vertex: position,
+// normal, texcoord) and one index buffer, described by a mesh table, and are
+// drawn through a single VAO with base-vertex draws. Meshes are appended on
+// the CPU and uploaded once with mesh_buffer_upload().
+#define MAX_MESHES 16
+
+typedef struct {
+    GLint base_vertex;
+    GLsizei first_index;
+    GLsizei index_count;
+} MeshRange;
+
+// Layout fixed by glMultiDrawElementsIndirect
+typedef struct {
+    GLuint count;
+    GLuint instance_count;
+    GLuint first_index;
+    GLint base_vertex;
+    GLuint base_instance;
+} DrawCommand;
+
+typedef struct {
+    GLuint vao, vbo, ebo, instance_vbo;
+    MeshRange meshes[MAX_MESHES];
+    int mesh_count;
+    float* vertices;            // CPU staging, freed by mesh_buffer_upload()
+    unsigned int* indices;
+    int vertex_count, index_count;
+    int base_instance;          // GL_ARB_base_instance is available
+    int instance_offset;        // First instance the attributes point at (fallback path)
+} MeshBuffer;
+MeshBuffer mesh_buffer;
+
+// Appends a mesh and returns its id; indices are relative to its own vertices
+int mesh_buffer_add(MeshBuffer* mb, const float* vertices, int vertex_count, const unsigned int* indices,
+                    int index_count) {
+    if (mb->mesh_count == MAX_MESHES) { printf("Too many meshes (max %d)\n", MAX_MESHES); exit(1); }
+    mb->vertices = (float*)realloc(mb->vertices, (size_t)(mb->vertex_count + vertex_count) * 8 * sizeof(float));
+    mb->indices = (unsigned int*)realloc(mb->indices, (size_t)(mb->index_count + index_count) * sizeof(unsigned int));
+    if (!mb->vertices || !mb->indices) { printf("Out of memory for mesh %d\n", mb->mesh_count); exit(1); }
+    memcpy(mb->vertices + (size_t)mb->vertex_count * 8, vertices, (size_t)vertex_count * 8 * sizeof(float));
+    memcpy(mb->indices + mb->index_count, indices, (size_t)index_count * sizeof(unsigned int));
+    MeshRange* range = &mb->meshes[mb->mesh_count];
+    range->base_vertex = mb->vertex_count;
+    range->first_index = mb->index_count;
+    range->index_count = index_count;
+    mb->vertex_count += vertex_count;
+    mb->index_count += index_count;
+    return mb->mesh_count++;
+}
+
+// Points the bound VAO's per-vertex attributes at the shared buffers
+void mesh_buffer_vertex_attributes(const MeshBuffer* mb) {
+    glBindBuffer(GL_ARRAY_BUFFER, mb->vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mb->ebo);
+    // positions
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    // normals
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    // texcoords
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+}
+
+// Creates the shared buffers and the VAO; instance attributes read instanceVBO
+void mesh_buffer_upload(MeshBuffer* mb, GLuint instanceVBO) {
+    glGenVertexArrays(1, &mb->vao);
+    glGenBuffers(1, &mb->vbo);
+    glGenBuffers(1, &mb->ebo);
+    glBindVertexArray(mb->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, mb->vbo);
+    glBufferData(GL_ARRAY_BUFFER, (size_t)mb->vertex_count * 8 * sizeof(float), mb->vertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mb->ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, (size_t)mb->index_count * sizeof(unsigned int), mb->indices,
+                 GL_STATIC_DRAW);
+    mesh_buffer_vertex_attributes(mb);
+    // per-instance model matrix + color
+    mb->instance_vbo = instanceVBO;
+    mb->instance_offset = 0;
+    setup_instance_attributes(instanceVBO, 0);
+    glBindVertexArray(0);
+    free(mb->vertices);
+    free(mb->indices);
+    mb->vertices = NULL;
+    mb->indices = NULL;
+    mb->base_instance = GLAD_GL_VERSION_4_2 || glfwExtensionSupported("GL_ARB_base_instance");
+    if (!mb->base_instance || !(GLAD_GL_VERSION_4_3 || glfwExtensionSupported("GL_ARB_multi_draw_indirect")))
+        multi_draw_indirect = 0;
+}
+
+// Command drawing instances [firstInstance, firstInstance + instances) of a mesh
+DrawCommand mesh_buffer_command(const MeshBuffer* mb, int mesh, int instances, int firstInstance) {
+    const MeshRange* range = &mb->meshes[mesh];
+    DrawCommand cmd = { (GLuint)range->index_count, (GLuint)instances, (GLuint)range->first_index,
+                        range->base_vertex, (GLuint)firstInstance };
+    return cmd;
+}
+
+// Draws commands [first, first + count); the mesh buffer's VAO must be bound,
+// and for the indirect path the same commands must be in the bound
+// GL_DRAW_INDIRECT_BUFFER. Without it each command is its own draw; GL 3.3
+// has no base instance either, so the instance attributes are re-pointed
+// when it changes.
+void mesh_buffer_multi_draw(MeshBuffer* mb, const DrawCommand* commands, int first, int count) {
+    gl_state.draw_commands += count;
+    if (multi_draw_indirect) {
+        gl_state.draw_calls++;
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const void*)(first * sizeof(DrawCommand)),
+                                    count, 0);
+        return;
+    }
+    gl_state.draw_calls += count;
+    for (int i = first; i < first + count; ++i) {
+        const DrawCommand* cmd = &commands[i];
+        const void* indices = (const void*)((size_t)cmd->first_index * sizeof(unsigned int));
+        if (mb->base_instance) {
+            glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, cmd->count, GL_UNSIGNED_INT, indices,
+                                                          cmd->instance_count, cmd->base_vertex,
+                                                          cmd->base_instance);
+            continue;
+        }
+        if (mb->instance_offset != (int)cmd->base_instance) {
+            setup_instance_attributes(mb->instance_vbo, cmd->base_instance);
+            mb->instance_offset = cmd->base_instance;
         }
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, cmd->count, GL_UNSIGNED_INT, indices, cmd->instance_count,
+                                          cmd->base_vertex);
+    }
+}
+
+void mesh_buffer_cleanup(MeshBuffer* mb) {
+    glDeleteVertexArrays(1, &mb->vao);
+    glDeleteBuffers(1, &mb->vbo);
+    glDeleteBuffers(1, &mb->ebo);
+}
+// --- End Mesh Buffer ---
+
+// --- Hi-Z Occlusion Culling ---
+// --hiz (implies --gpu-cull) also occlusion-culls the main pass. The main
+// pass depth is copied and reduced by hiz_compute.glsl into a mip chain
+// where every texel holds the farthest depth beneath it, so at most 3x3
+// texel fetches, one level below the one where the sphere's screen rectangle
+// spans 2x2 texels, tell whether it is behind what was drawn.
+// The camera is culled in two phases to keep objects from popping in late:
+//   1. the GPU cull tests the objects in the frustum against the pyramid
+//      of the previous frame, with this frame's camera, and the main pass
+//      draws the ones it does not hide (RQ_MAIN)
+//   2. the pyramid is rebuilt from that depth, the objects hidden in
+//      phase 1 are retested against it and the survivors drawn (RQ_MAIN_LATE)
+// Phase 1 is only approximate while the camera moves; phase 2 draws
+// whatever it hid by mistake. The late draws are missing from the pyramid
+// the next frame starts with, which only makes its first phase keep more.
+#define HIZ_TEXTURE_UNIT 3
+#define HIZ_GROUP_SIZE 8 // local_size_x/y in hiz_compute.glsl
+
+typedef struct {
+    int enabled;
+    int valid;      // The pyramid holds a frame at the current size
+    Program* program;
+    GLuint depth;   // Copy of the main pass depth buffer
+    GLuint pyramid; // R32F mip chain of farthest depths
+    int width, height, levels;
+} HiZ;
+HiZ hiz;
+
+// Matches the pyramid to the main target's size; a new size empties it
+void hiz_resize(HiZ* h, int width, int height) {
+    if (h->width == width && h->height == height) return;
+    if (!h->program) {
+        h->program = create_program("hiz_compute.glsl", NULL, NULL);
+        if (!headless) hot_reload_watch(h->program);
     }
-    memcpy(out, temp, sizeof(temp));
+    glDeleteTextures(1, &h->depth);
+    glDeleteTextures(1, &h->pyramid);
+    h->width = width;
+    h->height = height;
+    h->levels = 1;
+    while ((width | height) >> h->levels) h->levels++;
+    h->valid = 0;
+    glGenTextures(1, &h->depth);
+    gl_state_bind_texture(HIZ_TEXTURE_UNIT, GL_TEXTURE_2D, h->depth);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glGenTextures(1, &h->pyramid);
+    gl_state_bind_texture(HIZ_TEXTURE_UNIT, GL_TEXTURE_2D, h->pyramid);
+    glTexStorage2D(GL_TEXTURE_2D, h->levels, GL_R32F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 }
 
-// --- End Matrix Helper Functions ---
+// Rebuilds the pyramid from the depth buffer of the bound read framebuffer
+void hiz_build(HiZ* h) {
+    gl_state_bind_texture(HIZ_TEXTURE_UNIT, GL_TEXTURE_2D, h->depth);
+    gl_state_active_texture(HIZ_TEXTURE_UNIT);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, h->width, h->height);
+    program_use(h->program);
+    program_set_int(h->program, "depth", HIZ_TEXTURE_UNIT);
+    for (int level = 0; level < h->levels; ++level) {
+        int w = h->width >> level, ht = h->height >> level;
+        if (w < 1) w = 1;
+        if (ht < 1) ht = 1;
+        program_set_int(h->program, "level", level);
+        if (level > 0) glBindImageTexture(0, h->pyramid, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+        glBindImageTexture(1, h->pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glDispatchCompute((w + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, (ht + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+    }
+    h->valid = 1;
+}
 
-// --- Draw Cubes Function ---
-void drawCubes(GLuint shader) {
-    int gridX = 10;
-    int gridZ = 5;
-    float spacing = 1.1f;
+void hiz_cleanup(HiZ* h) {
+    if (!h->program) return;
+    delete_program(h->program);
+    glDeleteTextures(1, &h->depth);
+    glDeleteTextures(1, &h->pyramid);
+}
+// --- End Hi-Z Occlusion Culling ---
+
+// --- GPU Culling ---
+// --gpu-cull (GL 4.3) moves frustum culling to cull_compute.glsl: object
+// bounds live in a storage buffer, and one dispatch per frame tests every
+// object against the camera and each cascade. Survivors are appended to
+// the visible buffer and counted straight into the instance counts of the
+// render queue's indirect commands, so the CPU never touches individual
+// instances. Objects are grouped in batches (one per mesh, in instance
+// buffer order); each (view, batch) pair owns one draw command and a
+// range of the visible buffer as long as the batch. The INSTANCE_FETCH
+// shader variants draw through fetch_vao, which feeds the visible indices
+// as a per-instance attribute and reads instances from a texture buffer.
+// With --hiz the camera's second phase is one more view, GPU_CULL_LATE_VIEW.
+#define GPU_CULL_MAX_VIEWS (MAX_CASCADES + 2) // Camera first, then the cascades, then the late camera
+#define GPU_CULL_LATE_VIEW (MAX_CASCADES + 1)
+#define GPU_CULL_MAX_BATCHES 8
+#define GPU_CULL_GROUP_SIZE 64              // local_size_x in cull_compute.glsl
+#define GPU_CULL_INSTANCE_UNIT 2            // Texture unit of the instance texture buffer
+
+typedef struct {
+    int enabled;
+    Program* program;
+    GLuint bounds, batches, visible; // Storage buffers (visible is also an instanced attribute)
+    GLuint pending;                  // Per object: hidden by the first Hi-Z phase
+    GLuint instance_tex;             // GL_TEXTURE_BUFFER view of the instance buffer
+    GLuint fetch_vao;
+    int objects;
+    int batch_first[GPU_CULL_MAX_BATCHES], batch_size[GPU_CULL_MAX_BATCHES];
+    int batch_count;
+} GpuCull;
+GpuCull gpu_cull;
+
+int gpu_cull_supported(void) {
+    return GLAD_GL_VERSION_4_3 && multi_draw_indirect;
+}
+
+void gpu_cull_init(GpuCull* gc, const MeshBuffer* mb, GLuint instanceVBO) {
+    gc->program = create_program("cull_compute.glsl", NULL, NULL);
+    if (!headless) hot_reload_watch(gc->program);
+    glGenBuffers(1, &gc->bounds);
+    glGenBuffers(1, &gc->batches);
+    glGenBuffers(1, &gc->visible);
+    glGenBuffers(1, &gc->pending);
+    glGenTextures(1, &gc->instance_tex);
+    glBindTexture(GL_TEXTURE_BUFFER, gc->instance_tex);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, instanceVBO); // Follows the buffer when it is reallocated
+    glGenVertexArrays(1, &gc->fetch_vao);
+    glBindVertexArray(gc->fetch_vao);
+    mesh_buffer_vertex_attributes(mb);
+    glBindBuffer(GL_ARRAY_BUFFER, gc->visible);
+    glVertexAttribIPointer(11, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+    glEnableVertexAttribArray(11);
+    glVertexAttribDivisor(11, 1);
+    glBindVertexArray(0);
+}
+
+// (Re)uploads the bounds of every batch; batch b's objects must be
+// instances batch_first[b].. in the instance buffer
+void gpu_cull_set_objects(GpuCull* gc, const CullBounds* const* batches, int batchCount) {
+    gc->batch_count = batchCount;
+    gc->objects = 0;
+    for (int b = 0; b < batchCount; ++b) {
+        gc->batch_first[b] = gc->objects;
+        gc->batch_size[b] = batches[b]->count;
+        gc->objects += batches[b]->count;
+    }
+    GLint max_texels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+    if ((long long)gc->objects * (long long)sizeof(InstanceData) / 16 > (long long)max_texels)
+        printf("GPU culling: %d instances exceed GL_MAX_TEXTURE_BUFFER_SIZE (%d texels)\n", gc->objects, max_texels);
+    float* bounds = (float*)malloc((size_t)gc->objects * 4 * sizeof(float));
+    GLuint* batchOf = (GLuint*)malloc((size_t)gc->objects * sizeof(GLuint));
+    if (!bounds || !batchOf) { printf("Out of memory for %d GPU cull objects\n", gc->objects); exit(1); }
+    for (int b = 0; b < batchCount; ++b) {
+        for (int i = 0; i < batches[b]->count; ++i) {
+            float* o = &bounds[(size_t)(gc->batch_first[b] + i) * 4];
+            o[0] = batches[b]->x[i];
+            o[1] = batches[b]->y[i];
+            o[2] = batches[b]->z[i];
+            o[3] = batches[b]->r[i];
+            batchOf[gc->batch_first[b] + i] = b;
+        }
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gc->bounds);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (size_t)gc->objects * 4 * sizeof(float), bounds, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gc->batches);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (size_t)gc->objects * sizeof(GLuint), batchOf, GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gc->visible);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (size_t)gc->objects * GPU_CULL_MAX_VIEWS * sizeof(GLuint), NULL,
+                 GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gc->pending);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (size_t)gc->objects * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+    free(bounds);
+    free(batchOf);
+}
+
+// Rewrites one moving object's bound (object index = instance index)
+void gpu_cull_update_object(GpuCull* gc, int object, const CullBounds* b, int i) {
+    float bound[4] = { b->x[i], b->y[i], b->z[i], b->r[i] };
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gc->bounds);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, (size_t)object * sizeof(bound), sizeof(bound), bound);
+}
+
+// Command slot and first instance (in the visible buffer) of a view's batch
+int gpu_cull_slot(int view, int batch) {
+    return view * GPU_CULL_MAX_BATCHES + batch;
+}
+
+int gpu_cull_first_instance(const GpuCull* gc, int view, int batch) {
+    return view * gc->objects + gc->batch_first[batch];
+}
+
+// Tests every object against views (camera + `cascades` light frusta) and
+// fills the instance counts of the commands listed in commandIndex (one
+// per slot, -1 = not queued). The commands must already be in
+// indirectBuffer with zero instances. With Hi-Z culling on, phase 0 is
+// the first phase and phase 1 the late one, which only fills the late
+// view's commands and needs hiz_build() in between.
+void gpu_cull_dispatch(GpuCull* gc, const CullViews* views, int cascades, const int* commandIndex,
+                       GLuint indirectBuffer, int phase) {
+    // Commands are packed per view in dispatch order, the late view last
+    int viewCount = cascades + 1;
+    float planes[GPU_CULL_MAX_VIEWS][6][4];
+    memcpy(planes[0], views->camera, sizeof(planes[0]));
+    memcpy(planes[1], views->light, cascades * sizeof(planes[0]));
+    int commands[GPU_CULL_MAX_VIEWS * GPU_CULL_MAX_BATCHES];
+    for (int v = 0; v <= viewCount; ++v)
+        for (int b = 0; b < gc->batch_count; ++b)
+            commands[v * gc->batch_count + b] = commandIndex[gpu_cull_slot(v < viewCount ? v : GPU_CULL_LATE_VIEW, b)];
+    program_use(gc->program);
+    program_set_int(gc->program, "objectCount", gc->objects);
+    program_set_int(gc->program, "batchCount", gc->batch_count);
+    program_set_int(gc->program, "firstView", phase ? viewCount : 0);
+    program_set_int(gc->program, "phase", phase);
+    program_set_int(gc->program, "occlusion", hiz.enabled);
+    program_set_int(gc->program, "hizValid", hiz.valid);
+    program_set_int(gc->program, "hiz", HIZ_TEXTURE_UNIT);
+    program_set_mat4(gc->program, "viewProj", views->camera_clip);
+    // No typed setters for arrays; like the setters, skip uniforms that are not active
+    UniformInfo* u = program_uniform(gc->program, "planes");
+    if (u) glUniform4fv(u->location, viewCount * 6, &planes[0][0][0]);
+    u = program_uniform(gc->program, "commandIndex");
+    if (u) glUniform1iv(u->location, (viewCount + 1) * gc->batch_count, commands);
+    if (hiz.valid) gl_state_bind_texture(HIZ_TEXTURE_UNIT, GL_TEXTURE_2D, hiz.pyramid);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, gc->bounds);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, gc->batches);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, gc->visible);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, indirectBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, gc->pending);
+    glDispatchCompute((gc->objects + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE, phase ? 1 : viewCount, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// Reads the instance counts back (stalls until the dispatch is done) into
+// cull_stats; the headless loop has already waited for the GPU anyway
+void gpu_cull_read_stats(const GpuCull* gc, int cascades, const int* commandIndex, GLuint indirectBuffer) {
+    int main_visible = 0, shadow_visible = 0, late_visible = 0;
+    // The counts were written through an SSBO; glGetBufferSubData needs this
+    // barrier to see them, and only the readback pays for it
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+    for (int i = 0; i <= cascades + 1; ++i) {
+        int v = i <= cascades ? i : GPU_CULL_LATE_VIEW;
+        for (int b = 0; b < gc->batch_count; ++b) {
+            int command = commandIndex[gpu_cull_slot(v, b)];
+            if (command < 0) continue;
+            GLuint instances = 0;
+            glGetBufferSubData(GL_DRAW_INDIRECT_BUFFER, command * sizeof(DrawCommand) + offsetof(DrawCommand, instance_count),
+                               sizeof(instances), &instances);
+            if (v == GPU_CULL_LATE_VIEW) late_visible += instances;
+            else if (v == 0) main_visible += instances;
+            else shadow_visible += instances;
+        }
+    }
+    cull_stats.main_visible = main_visible + late_visible;
+    cull_stats.late_visible = late_visible;
+    cull_stats.shadow_visible = shadow_visible;
+}
+
+void gpu_cull_cleanup(GpuCull* gc) {
+    if (!gc->program) return;
+    delete_program(gc->program);
+    glDeleteBuffers(1, &gc->bounds);
+    glDeleteBuffers(1, &gc->batches);
+    glDeleteBuffers(1, &gc->visible);
+    glDeleteBuffers(1, &gc->pending);
+    glDeleteTextures(1, &gc->instance_tex);
+    glDeleteVertexArrays(1, &gc->fetch_vao);
+}
+// --- End GPU Culling ---
+
+// --- Cube Grid Instances ---
+#define CUBE_BOUNDING_RADIUS 0.8660254f // Half the diagonal of the unit cube
+// Grid dimensions (x, y, z); --grid XxYxZ overrides the default 10x1x5
+int cube_grid[3] = { 10, 1, 5 };
+float cube_spacing = 1.1f;
+
+// Builds gridX*gridY*gridZ cube instances into out and returns the count
+int build_cube_instances(InstanceData* out, int gridX, int gridY, int gridZ) {
+    float spacing = cube_spacing;
     int centerI = gridX / 2;
     int centerJ = gridZ / 2;
-    GLint useTextureLoc = glGetUniformLocation(shader, "useTexture");
-    GLint objectColorLoc = glGetUniformLocation(shader, "objectColor");
-    if (useTextureLoc != -1) glUniform1i(useTextureLoc, 1);
+    int n = 0;
     for (int i = 0; i < gridX; ++i) {
-        for (int j = 0; j < gridZ; ++j) {
-            float model[16];
-            mat4_identity(model);
-            float xPos = (i - (gridX - 1) / 2.0f) * spacing;
-            float zPos = (j - (gridZ - 1) / 2.0f) * spacing;
-            model[12] = xPos;
-            // Lift the center cube and make it yellow
-            if (i == centerI && j == centerJ) {
-                model[13] = 1.0f;
-                if (objectColorLoc != -1) glUniform3f(objectColorLoc, 1.0f, 1.0f, 0.0f); // Yellow
-            } else {
-                model[13] = 0.0f;
-                if (objectColorLoc != -1) glUniform3f(objectColorLoc, 1.0f, 1.0f, 1.0f); // White
+        for (int k = 0; k < gridY; ++k) {
+            for (int j = 0; j < gridZ; ++j) {
+                InstanceData* inst = &out[n++];
+                mat4_identity(inst->model);
+                inst->model[12] = (i - (gridX - 1) / 2.0f) * spacing;
+                inst->model[13] = k * spacing;
+                inst->model[14] = (j - (gridZ - 1) / 2.0f) * spacing;
+                // Lift the center cube of the top layer and make it yellow
+                int center = (i == centerI && j == centerJ && k == gridY - 1);
+                if (center) inst->model[13] += 1.0f;
+                inst->color[0] = 1.0f;
+                inst->color[1] = 1.0f;
+                inst->color[2] = center ? 0.0f : 1.0f;
+                mat4_normal_matrix(inst->normal, inst->model);
             }
-            model[14] = zPos;
-            glUniformMatrix4fv(glGetUniformLocation(shader, "model"), 1, GL_FALSE, model);
-            glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-        }
-    }
-}
-// --- End Draw Cubes Function ---
-
-// --- Draw Sphere Function ---
-void drawSphere(GLuint shader) {
-    float t = (float)glfwGetTime();
-    float sphere_x = 2.0f * sinf(t);
-    float sphere_y = 2.0f;
-    float sphere_z = 0.0f;
-    float sphere_model[16];
-    mat4_identity(sphere_model);
-    sphere_model[12] = sphere_x;
-    sphere_model[13] = sphere_y;
-    sphere_model[14] = sphere_z;
-    GLint useTextureLoc = glGetUniformLocation(shader, "useTexture");
-    GLint objectColorLoc = glGetUniformLocation(shader, "objectColor");
-    if (useTextureLoc != -1) glUniform1i(useTextureLoc, 0);
-    if (objectColorLoc != -1) glUniform3f(objectColorLoc, 1.0f, 0.5f, 0.0f);
-    glUniformMatrix4fv(glGetUniformLocation(shader, "model"), 1, GL_FALSE, sphere_model);
-    glDrawElements(GL_TRIANGLES, SPHERE_LAT * SPHERE_LON * 6, GL_UNSIGNED_INT, 0);
-}
-// --- End Draw Sphere Function ---
-
-int main(void) {
-    if (!glfwInit()) return -1;
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        }
+    }
+    return n;
+}
+
+// The grid is static, so its instances are built and uploaded once per grid
+// size, and their bounding spheres are stored in bounds. The buffer is
+// reallocated, so the sphere's slot is rewritten by the next frame.
+int upload_cube_grid(GLuint instanceVBO, const int grid[3], CullBounds* bounds) {
+    size_t count = (size_t)grid[0] * grid[1] * grid[2];
+    InstanceData* instances = (InstanceData*)malloc(count * sizeof(InstanceData));
+    if (!instances) { printf("Out of memory for %zu cube instances\n", count); exit(1); }
+    int n = build_cube_instances(instances, grid[0], grid[1], grid[2]);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, (CUBE_FIRST_INSTANCE + n) * sizeof(InstanceData), NULL, GL_DYNAMIC_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, CUBE_FIRST_INSTANCE * sizeof(InstanceData), n * sizeof(InstanceData), instances);
+    cull_bounds_resize(bounds, n);
+    for (int i = 0; i < n; ++i) cull_bounds_set(bounds, i, instances[i].model, CUBE_BOUNDING_RADIUS);
+    if (bvh_enabled) bvh_build(&bounds->bvh, bounds->x, bounds->y, bounds->z, bounds->r, n);
+    free(instances);
+    return n;
+}
+
+// Pulls the orbit camera back far enough to keep the whole grid in view
+void fit_camera_to_grid(const int grid[3]) {
+    float hx = grid[0] * cube_spacing * 0.5f, hy = grid[1] * cube_spacing, hz = grid[2] * cube_spacing * 0.5f;
+    float radius = sqrtf(hx * hx + hy * hy + hz * hz);
+    cam_dist = radius * 1.9f > 12.0f ? radius * 1.9f : 12.0f;
+    cam_far = cam_dist + radius * 2.0f > 50.0f ? cam_dist + radius * 2.0f : 50.0f;
+    // Room for the lifted center cube and the orbiting sphere
+    scene_radius = radius + 1.5f > 4.0f ? radius + 1.5f : 4.0f;
+}
+
+// Parses "XxYxZ" (or "XxZ" for a single layer)
+int parse_grid(const char* arg, int grid[3]) {
+    int x, y, z;
+    if (sscanf(arg, "%dx%dx%d", &x, &y, &z) == 3) {
+        grid[0] = x; grid[1] = y; grid[2] = z;
+    } else if (sscanf(arg, "%dx%d", &x, &z) == 2) {
+        grid[0] = x; grid[1] = 1; grid[2] = z;
+    } else {
+        return 0;
+    }
+    return grid[0] > 0 && grid[1] > 0 && grid[2] > 0;
+}
+
+// Square-ish XZ footprint holding at least count cubes with grid[1] layers
+void grid_for_count(int count, int grid[3]) {
+    int layers = grid[1];
+    int side = (int)ceil(sqrt((double)count / layers));
+    if (side < 1) side = 1;
+    grid[0] = side;
+    grid[2] = (count + side * layers - 1) / (side * layers);
+    if (grid[2] < 1) grid[2] = 1;
+}
+// --- End Cube Grid Instances ---
+
+// --- Stress Mode ---
+// --stress <budget_ms> doubles the cube count until the mean frame time
+// exceeds the budget, then bisects between the last passing and first
+// failing counts to find the maximum sustainable instance count.
+#define STRESS_WARMUP_FRAMES 5
+#define STRESS_SAMPLE_FRAMES 30
+#define STRESS_MAX_INSTANCES (1 << 22)
+#define STRESS_MAX_STEPS 32
+
+typedef struct {
+    int instances;
+    float mean_ms, p95_ms;
+} StressStep;
+
+typedef struct {
+    int count;       // Instances being measured
+    int good, bad;   // Largest count within budget / smallest over it (0 = none yet)
+    int frame;       // Frame within the current step
+    float samples[STRESS_SAMPLE_FRAMES];
+    StressStep steps[STRESS_MAX_STEPS];
+    int step_count;
+    int done;
+} StressState;
+
+// Records one frame; returns 1 when cube_grid changed and must be re-uploaded
+int stress_record_frame(StressState* stress, float ms) {
+    int f = stress->frame++ - STRESS_WARMUP_FRAMES;
+    if (f < 0) return 0;
+    stress->samples[f] = ms;
+    if (f + 1 < STRESS_SAMPLE_FRAMES) return 0;
+
+    double sum = 0.0;
+    for (int i = 0; i < STRESS_SAMPLE_FRAMES; ++i) sum += stress->samples[i];
+    qsort(stress->samples, STRESS_SAMPLE_FRAMES, sizeof(float), compare_floats);
+    StressStep* step = &stress->steps[stress->step_count++];
+    step->instances = stress->count;
+    step->mean_ms = (float)(sum / STRESS_SAMPLE_FRAMES);
+    step->p95_ms = percentile(stress->samples, STRESS_SAMPLE_FRAMES, 95.0f);
+    fprintf(stderr, "stress: %d instances, mean %.3f ms\n", step->instances, step->mean_ms);
+
+    int next;
+    if (step->mean_ms <= stress_budget_ms) {
+        stress->good = stress->count;
+        next = stress->bad ? (stress->good + stress->bad) / 2 : stress->count * 2;
+    } else {
+        stress->bad = stress->count;
+        next = stress->good ? (stress->good + stress->bad) / 2 : stress->count / 2;
+    }
+    // Stop once the bracket is within 5% or nothing new is left to try
+    int converged = stress->bad && stress->bad - stress->good <= (stress->good / 20 > 1 ? stress->good / 20 : 1);
+    if (next < 1 || converged || stress->step_count == STRESS_MAX_STEPS) {
+        stress->done = 1;
+        return 0;
+    }
+    // Snap to a whole grid, which rounds up, then drop rows until it fits
+    // the cap; stop if that lands on a count already measured
+    int grid[3] = { 0, cube_grid[1], 0 };
+    grid_for_count(next, grid);
+    if ((long long)grid[0] * grid[1] * grid[2] > STRESS_MAX_INSTANCES) {
+        grid[2] = STRESS_MAX_INSTANCES / (grid[0] * grid[1]);
+        if (grid[2] < 1) grid[2] = 1;
+    }
+    next = grid[0] * grid[1] * grid[2];
+    if (next == stress->count || next == stress->good || next == stress->bad) {
+        stress->done = 1;
+        return 0;
+    }
+    memcpy(cube_grid, grid, sizeof(grid));
+    stress->count = next;
+    stress->frame = 0;
+    return 1;
+}
+
+void print_stress_report(const StressState* stress) {
+    printf("{\n");
+    printf("  \"budget_ms\": %.4f,\n", stress_budget_ms);
+    printf("  \"layers\": %d,\n", cube_grid[1]);
+    printf("  \"renderer\": \"%s\",\n", (const char*)glGetString(GL_RENDERER));
+    printf("  \"steps\": [\n");
+    for (int i = 0; i < stress->step_count; ++i) {
+        const StressStep* step = &stress->steps[i];
+        printf("    {\"instances\": %d, \"mean_ms\": %.4f, \"p95_ms\": %.4f}%s\n",
+               step->instances, step->mean_ms, step->p95_ms, i + 1 < stress->step_count ? "," : "");
+    }
+    printf("  ],\n");
+    printf("  \"max_sustainable_instances\": %d\n", stress->good);
+    printf("}\n");
+}
+// --- End Stress Mode ---
+
+// --- Render Queue ---
+// Draws are queued as DrawItems with a 64-bit sort key and radix-sorted once
+// per frame, so each pass is submitted grouped by program, then texture,
+// then mesh, and front to back within that, which lets the GL state cache
+// drop most binds. After sorting, every item becomes a DrawCommand in one
+// indirect buffer, and each run of items sharing a program and texture is
+// a single multi-draw call. Key layout, most significant first:
+//   pass (4) | program (12) | texture (12) | mesh (12) | view depth (24)
+// Passes, in key order: static and dynamic casters of each cascade, then
+// the main pass and its Hi-Z late phase
+#define RQ_SHADOW_STATIC(c)  ((c) * 2)
+#define RQ_SHADOW_DYNAMIC(c) ((c) * 2 + 1)
+#define RQ_MAIN              (MAX_CASCADES * 2)
+#define RQ_MAIN_LATE         (RQ_MAIN + 1)
+#define RQ_PASS_SHIFT    60
+#define RQ_PROGRAM_SHIFT 48
+#define RQ_TEXTURE_SHIFT 36
+#define RQ_MESH_SHIFT    24
+
+typedef struct {
+    ShaderFamily* shaders;
+    unsigned perm;         // Permutation key of the variant to bind
+    int mesh;              // Index into mesh_buffer
+    GLuint texture;        // Bound to unit 0; 0 = the draw samples no texture
+    int instance_count;
+    int first_instance;    // In the shared instance buffer, or the GPU culling visible buffer
+    int gpu_slot;          // GPU culling command slot, -1 = instance count known on the CPU
+} DrawItem;
+
+typedef struct {
+    unsigned long long key;
+    int item;
+} SortEntry;
+
+typedef struct {
+    DrawItem* items;
+    SortEntry* entries;
+    SortEntry* scratch;
+    DrawCommand* commands; // In sorted order, filled by render_queue_sort()
+    int count, capacity;
+    GLuint indirect_buffer;
+    int indirect_capacity;
+    int gpu_commands[GPU_CULL_MAX_VIEWS * GPU_CULL_MAX_BATCHES]; // Slot -> sorted command, -1 = none
+} RenderQueue;
+
+void render_queue_reset(RenderQueue* q) {
+    q->count = 0;
+    memset(q->gpu_commands, 0xFF, sizeof(q->gpu_commands));
+}
+
+// viewDepth is the distance from the camera, used to order draws front to back
+void render_queue_push(RenderQueue* q, int pass, ShaderFamily* shaders, unsigned perm, int mesh, GLuint texture,
+                       int instance_count, int first_instance, float viewDepth) {
+    if (instance_count <= 0) return;
+    if (q->count == q->capacity) {
+        q->capacity = q->capacity ? q->capacity * 2 : 64;
+        q->items = (DrawItem*)realloc(q->items, q->capacity * sizeof(DrawItem));
+        q->entries = (SortEntry*)realloc(q->entries, q->capacity * sizeof(SortEntry));
+        q->scratch = (SortEntry*)realloc(q->scratch, q->capacity * sizeof(SortEntry));
+        q->commands = (DrawCommand*)realloc(q->commands, q->capacity * sizeof(DrawCommand));
+    }
+    perm &= shaders->perm_mask;
+    DrawItem* item = &q->items[q->count];
+    item->shaders = shaders;
+    item->perm = perm;
+    item->mesh = mesh;
+    item->texture = texture;
+    item->instance_count = instance_count;
+    item->first_instance = first_instance;
+    item->gpu_slot = -1;
+    // Non-negative floats order like their bit patterns; keep the top 24 bits
+    unsigned int depth_bits;
+    if (viewDepth < 0.0f) viewDepth = 0.0f;
+    memcpy(&depth_bits, &viewDepth, sizeof(depth_bits));
+    unsigned long long program = ((unsigned long long)shaders->id * PERM_KEY_COUNT + perm) & 0xFFF;
+    SortEntry* e = &q->entries[q->count];
+    e->key = ((unsigned long long)pass << RQ_PASS_SHIFT) | (program << RQ_PROGRAM_SHIFT) |
+             ((unsigned long long)(texture & 0xFFF) << RQ_TEXTURE_SHIFT) |
+             ((unsigned long long)(mesh & 0xFFF) << RQ_MESH_SHIFT) | (depth_bits >> 8);
+    e->item = q->count;
+    q->count++;
+}
+
+// LSD radix sort on the keys, 8 bits per pass; bytes that are the same in
+// every key are skipped, which is most of them for small queues. Then
+// builds the draw commands in key order and uploads them for every pass.
+void render_queue_sort(RenderQueue* q) {
+    SortEntry* src = q->entries;
+    SortEntry* dst = q->scratch;
+    for (int shift = 0; shift < 64; shift += 8) {
+        int offsets[256] = { 0 };
+        for (int i = 0; i < q->count; ++i) offsets[(src[i].key >> shift) & 0xFF]++;
+        if (q->count == 0 || offsets[(src[0].key >> shift) & 0xFF] == q->count) continue;
+        int sum = 0;
+        for (int b = 0; b < 256; ++b) {
+            int n = offsets[b];
+            offsets[b] = sum;
+            sum += n;
+        }
+        for (int i = 0; i < q->count; ++i) dst[offsets[(src[i].key >> shift) & 0xFF]++] = src[i];
+        SortEntry* t = src;
+        src = dst;
+        dst = t;
+    }
+    q->entries = src;
+    q->scratch = dst;
+
+    for (int i = 0; i < q->count; ++i) {
+        const DrawItem* item = &q->items[q->entries[i].item];
+        q->commands[i] = mesh_buffer_command(&mesh_buffer, item->mesh, item->instance_count, item->first_instance);
+        if (item->gpu_slot >= 0) {
+            q->commands[i].instance_count = 0;
+            q->gpu_commands[item->gpu_slot] = i;
+        }
+    }
+    if (!multi_draw_indirect || q->count == 0) return;
+    if (!q->indirect_buffer) glGenBuffers(1, &q->indirect_buffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, q->indirect_buffer);
+    if (q->count > q->indirect_capacity) {
+        q->indirect_capacity = q->capacity;
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, q->indirect_capacity * sizeof(DrawCommand), NULL, GL_DYNAMIC_DRAW);
+    }
+    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, q->count * sizeof(DrawCommand), q->commands);
+}
+
+// Draws every item of passes [firstPass, lastPass] in key order; expects
+// render_queue_sort(). Adjacent passes with the same state merge into one call.
+void render_queue_submit(const RenderQueue* q, int firstPass, int lastPass) {
+    for (int i = 0; i < q->count;) {
+        int pass = (int)(q->entries[i].key >> RQ_PASS_SHIFT);
+        if (pass < firstPass || pass > lastPass) {
+            ++i;
+            continue;
+        }
+        // Items that only differ in mesh, instances or depth share one call
+        const DrawItem* item = &q->items[q->entries[i].item];
+        int n = 1;
+        while (i + n < q->count) {
+            const DrawItem* next = &q->items[q->entries[i + n].item];
+            if ((int)(q->entries[i + n].key >> RQ_PASS_SHIFT) > lastPass || next->shaders != item->shaders ||
+                next->perm != item->perm || next->texture != item->texture)
+                break;
+            n++;
+        }
+        // Runs that share a program cost only elided binds
+        shader_family_use(item->shaders, item->perm);
+        if (item->texture) gl_state_bind_texture(0, GL_TEXTURE_2D, item->texture);
+        gl_state_bind_vao((item->perm & PERM_INSTANCE_FETCH) ? gpu_cull.fetch_vao : mesh_buffer.vao);
+        mesh_buffer_multi_draw(&mesh_buffer, q->commands, i, n);
+        i += n;
+    }
+}
+
+// Queues a draw whose instance count the GPU culling dispatch fills in
+void render_queue_push_gpu(RenderQueue* q, int pass, ShaderFamily* shaders, unsigned perm, int mesh,
+                           GLuint texture, int slot, int first_instance, float viewDepth) {
+    render_queue_push(q, pass, shaders, perm | PERM_INSTANCE_FETCH, mesh, texture, 1, first_instance, viewDepth);
+    q->items[q->count - 1].gpu_slot = slot;
+}
+
+// Frustum-culls bounds (unless planes is NULL), drops the survivors hidden
+// behind occlusion's occluders (unless it is NULL) and queues every run of
+// consecutive visible objects as one item; object i is instance
+// firstInstance + i. Returns the number of visible objects.
+int render_queue_push_visible(RenderQueue* q, int pass, ShaderFamily* shaders, unsigned perm, int mesh,
+                              GLuint texture, CullBounds* b, const float planes[6][4], OcclusionBuffer* occlusion,
+                              int firstInstance, const float* eye) {
+    if (planes && b->bvh.nodes) bvh_query_frustum(&b->bvh, b->visible, planes);
+    else if (planes) frustum_cull_spheres(b->visible, planes, b->x, b->y, b->z, b->r, b->count);
+    else memset(b->visible, 1, b->count);
+    if (occlusion) occlusion_test_boxes(occlusion, b->visible, b->x, b->y, b->z, b->r, b->count);
+    int visible = 0;
+    for (int i = 0; i < b->count;) {
+        if (!b->visible[i]) {
+            ++i;
+            continue;
+        }
+        int run = 1;
+        while (i + run < b->count && b->visible[i + run]) run++;
+        float d[3] = { b->x[i] - eye[0], b->y[i] - eye[1], b->z[i] - eye[2] };
+        render_queue_push(q, pass, shaders, perm, mesh, texture, run, firstInstance + i, sqrtf(vec3_dot(d, d)));
+        visible += run;
+        i += run;
+    }
+    return visible;
+}
+
+void render_queue_free(RenderQueue* q) {
+    free(q->items);
+    free(q->entries);
+    free(q->scratch);
+    free(q->commands);
+    if (q->indirect_buffer) glDeleteBuffers(1, &q->indirect_buffer);
+    memset(q, 0, sizeof(*q));
+}
+// --- End Render Queue ---
+
+// --- Queue Cubes Function ---
+// The grid never moves, so it is a static shadow caster; the main pass
+// textures it with the pass's shadow tier. views is NULL when not culling.
+void queueCubes(RenderQueue* q, ShaderFamily* scene, ShaderFamily* depth, unsigned sceneKey, int mesh,
+                GLuint texture, CullBounds* bounds, const CullViews* views, const float* eye) {
+    if (gpu_cull.enabled) {
+        // View 0 is the camera, view c + 1 cascade c
+        float viewDepth = sqrtf(vec3_dot(eye, eye));
+        for (int c = 0; c < shadow_cascades; ++c)
+            render_queue_push_gpu(q, RQ_SHADOW_STATIC(c), depth, 0, mesh, 0, gpu_cull_slot(c + 1, CUBE_BATCH),
+                                  gpu_cull_first_instance(&gpu_cull, c + 1, CUBE_BATCH), viewDepth);
+        render_queue_push_gpu(q, RQ_MAIN, scene, sceneKey | PERM_USE_TEXTURE, mesh, texture,
+                              gpu_cull_slot(0, CUBE_BATCH), gpu_cull_first_instance(&gpu_cull, 0, CUBE_BATCH),
+                              viewDepth);
+        if (hiz.enabled)
+            render_queue_push_gpu(q, RQ_MAIN_LATE, scene, sceneKey | PERM_USE_TEXTURE, mesh, texture,
+                                  gpu_cull_slot(GPU_CULL_LATE_VIEW, CUBE_BATCH),
+                                  gpu_cull_first_instance(&gpu_cull, GPU_CULL_LATE_VIEW, CUBE_BATCH), viewDepth);
+        return;
+    }
+    for (int c = 0; c < shadow_cascades; ++c)
+        cull_stats.shadow_visible += render_queue_push_visible(q, RQ_SHADOW_STATIC(c), depth, 0, mesh, 0, bounds,
+                                                               views ? views->light[c] : NULL, NULL,
+                                                               CUBE_FIRST_INSTANCE, eye);
+    cull_stats.main_visible += render_queue_push_visible(q, RQ_MAIN, scene, sceneKey | PERM_USE_TEXTURE, mesh,
+                                                         texture, bounds, views ? views->camera : NULL,
+                                                         views && sw_occlusion_enabled ? &sw_occlusion : NULL,
+                                                         CUBE_FIRST_INSTANCE, eye);
+}
+// --- End Queue Cubes Function ---
+
+// --- Queue Sphere Function ---
+#define SPHERE_BOUNDING_RADIUS 0.4f // generate_sphere_mesh() radius
+// The sphere moves, so its single instance is rewritten once per frame;
+// its world position is returned in pos
+void updateSphereInstance(GLuint instanceVBO, float t, float* pos) {
+    InstanceData inst;
+    mat4_identity(inst.model);
+    inst.model[12] = 2.0f * sinf(t);
+    inst.model[13] = 2.0f;
+    inst.model[14] = 0.0f;
+    inst.color[0] = 1.0f;
+    inst.color[1] = 0.5f;
+    inst.color[2] = 0.0f;
+    mat4_normal_matrix(inst.normal, inst.model);
+    memcpy(pos, &inst.model[12], 3 * sizeof(float));
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    glBufferSubData(GL_ARRAY_BUFFER, SPHERE_INSTANCE * sizeof(inst), sizeof(inst), &inst);
+}
+
+// A dynamic shadow caster. It floats above every other caster and its own
+// back faces are unlit anyway, so it skips the shadow lookup entirely.
+void queueSphere(RenderQueue* q, ShaderFamily* scene, ShaderFamily* depth, unsigned sceneKey, int mesh,
+                 CullBounds* bounds, const CullViews* views, const float* eye) {
+    if (gpu_cull.enabled) {
+        float d[3] = { bounds->x[0] - eye[0], bounds->y[0] - eye[1], bounds->z[0] - eye[2] };
+        float viewDepth = sqrtf(vec3_dot(d, d));
+        for (int c = 0; c < shadow_cascades; ++c)
+            render_queue_push_gpu(q, RQ_SHADOW_DYNAMIC(c), depth, 0, mesh, 0, gpu_cull_slot(c + 1, SPHERE_BATCH),
+                                  gpu_cull_first_instance(&gpu_cull, c + 1, SPHERE_BATCH), viewDepth);
+        render_queue_push_gpu(q, RQ_MAIN, scene, sceneKey & ~PERM_RECEIVE_SHADOWS, mesh, 0,
+                              gpu_cull_slot(0, SPHERE_BATCH), gpu_cull_first_instance(&gpu_cull, 0, SPHERE_BATCH),
+                              viewDepth);
+        if (hiz.enabled)
+            render_queue_push_gpu(q, RQ_MAIN_LATE, scene, sceneKey & ~PERM_RECEIVE_SHADOWS, mesh, 0,
+                                  gpu_cull_slot(GPU_CULL_LATE_VIEW, SPHERE_BATCH),
+                                  gpu_cull_first_instance(&gpu_cull, GPU_CULL_LATE_VIEW, SPHERE_BATCH), viewDepth);
+        return;
+    }
+    for (int c = 0; c < shadow_cascades; ++c)
+        cull_stats.shadow_visible += render_queue_push_visible(q, RQ_SHADOW_DYNAMIC(c), depth, 0, mesh, 0, bounds,
+                                                               views ? views->light[c] : NULL, NULL,
+                                                               SPHERE_INSTANCE, eye);
+    cull_stats.main_visible += render_queue_push_visible(q, RQ_MAIN, scene, sceneKey & ~PERM_RECEIVE_SHADOWS, mesh,
+                                                         0, bounds, views ? views->camera : NULL,
+                                                         views && sw_occlusion_enabled ? &sw_occlusion : NULL,
+                                                         SPHERE_INSTANCE, eye);
+}
+// --- End Queue Sphere Function ---
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+            bench_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--stress") == 0 && i + 1 < argc) {
+            stress_budget_ms = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--grid") == 0 && i + 1 < argc && parse_grid(argv[i + 1], cube_grid)) {
+            ++i;
+        } else if (strcmp(argv[i], "--shadow-quality") == 0 && i + 1 < argc) {
+            shadow_quality = atoi(argv[++i]);
+            if (shadow_quality < 0 || shadow_quality >= SHADOW_QUALITY_COUNT) shadow_quality = SHADOW_TAPS_4;
+        } else if (strcmp(argv[i], "--sphere") == 0 && i + 1 < argc &&
+                   sscanf(argv[i + 1], "%dx%d", &sphere_lat, &sphere_lon) == 2 && sphere_lat > 1 && sphere_lon > 2) {
+            ++i;
+        } else if (strcmp(argv[i], "--shader-normal-matrix") == 0) {
+            shader_normal_matrix = 1;
+        } else if (strcmp(argv[i], "--cascades") == 0 && i + 1 < argc) {
+            shadow_cascades = atoi(argv[++i]);
+            if (shadow_cascades < 1 || shadow_cascades > MAX_CASCADES) shadow_cascades = 3;
+        } else if (strcmp(argv[i], "--shadow-size") == 0 && i + 1 < argc) {
+            shadow_size = atoi(argv[++i]);
+            if (shadow_size < 64 || shadow_size > 8192) shadow_size = 1024;
+        } else if (strcmp(argv[i], "--no-program-cache") == 0) {
+            program_cache_enabled = 0;
+        } else if (strcmp(argv[i], "--no-shadow-cache") == 0) {
+            shadow_cache_enabled = 0;
+        } else if (strcmp(argv[i], "--no-indirect") == 0) {
+            multi_draw_indirect = 0;
+        } else if (strcmp(argv[i], "--no-cull") == 0) {
+            frustum_cull_enabled = 0;
+        } else if (strcmp(argv[i], "--bvh") == 0) {
+            bvh_enabled = 1;
+        } else if (strcmp(argv[i], "--gpu-cull") == 0) {
+            gpu_cull.enabled = 1;
+        } else if (strcmp(argv[i], "--hiz") == 0) {
+            hiz.enabled = gpu_cull.enabled = 1;
+        } else if (strcmp(argv[i], "--sw-occlusion") == 0) {
+            sw_occlusion_enabled = 1;
+        } else if (strcmp(argv[i], "--occlusion-threads") == 0 && i + 1 < argc) {
+            sw_occlusion_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--occlusion-scene") == 0) {
+            // A tall grid seen low and across its diagonal: the front rows hide most of it
+            cube_grid[0] = 64;
+            cube_grid[1] = 8;
+            cube_grid[2] = 64;
+            cam_yaw = 45.0f;
+            cam_pitch = 5.0f;
+        } else {
+            printf("Usage: %s [--bench <frames>] [--stress <budget_ms>] [--grid XxYxZ] [--sphere LATxLON]\n"
+                   "       [--shadow-quality 0-3 (1 tap, 4 taps, 9 taps, Poisson)] [--no-shadow-cache]\n"
+                   "       [--cascades 1-4] [--shadow-size <texels>] [--no-program-cache] [--no-indirect]\n"
+                   "       [--no-cull] [--bvh] [--gpu-cull] [--hiz] [--sw-occlusion] [--occlusion-threads <n>]\n"
+                   "       [--occlusion-scene] [--shader-normal-matrix]\n", argv[0]);
+            return -1;
+        }
+    }
+    headless = bench_frames > 0 || stress_budget_ms > 0.0f;
+    if (!frustum_cull_enabled) gpu_cull.enabled = hiz.enabled = sw_occlusion_enabled = 0;
+
+    GLFWwindow* window;
+    if (headless) {
+        window = create_bench_window();
+    } else {
+        if (!glfwInit()) return -1;
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 #ifdef __APPLE__
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
-    GLFWwindow* window = glfwCreateWindow(640, 480, "Rotating 3D Cube", NULL, NULL);
+        window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Rotating 3D Cube", NULL, NULL);
+    }
     if (!window) { glfwTerminate(); return -1; }
     glfwMakeContextCurrent(window);
     if (!gladLoadGL((GLADloadfunc)glfwGetProcAddress)) {
@@ -377,30 +2352,69 @@ int main(void) {
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     glfwSetMouseButtonCallback(window, mouse_button_callback);
     glfwSetCursorPosCallback(window, cursor_position_callback);
+    glfwSetKeyCallback(window, key_callback);
 
-    GLuint shader = create_program("vertex_shader.glsl", "fragment_shader.glsl");
-    depthShaderProgram = create_program("depth_vertex_shader.glsl", "depth_fragment_shader.glsl"); // Compile depth shader
-
-    // Setup cube VAO/VBO/EBO
-    GLuint VAO, VBO, EBO;
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(cube_vertices), cube_vertices, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cube_indices), cube_indices, GL_STATIC_DRAW);
-    // positions
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    // normals
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-    // texcoords
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-    glEnableVertexAttribArray(2);
-    glBindVertexArray(0);
+    // Both programs build in the background while the rest of startup runs;
+    // program_use() waits for each the first time it is bound
+    parallel_compile_init();
+    // Edited shaders are rebuilt and swapped in without a restart
+    if (!headless) hot_reload_init();
+    ShaderFamily sceneShaders = { .vs_path = "vertex_shader.glsl", .fs_path = "fragment_shader.glsl",
+                                  .perm_mask = PERM_USE_TEXTURE | PERM_RECEIVE_SHADOWS | (3u << PERM_TAPS_SHIFT) |
+                                               PERM_INSTANCE_FETCH | PERM_SHADER_NORMAL_MATRIX,
+                                  .id = 0 };
+    ShaderFamily depthShaders = { .vs_path = "depth_vertex_shader.glsl", .fs_path = "depth_fragment_shader.glsl",
+                                  .perm_mask = PERM_INSTANCE_FETCH, .id = 1 };
+    unsigned normalKey = shader_normal_matrix ? PERM_SHADER_NORMAL_MATRIX : 0;
+    unsigned sceneKey = perm_shadow_key(shadow_quality) | normalKey;
+    unsigned fetch = gpu_cull.enabled ? PERM_INSTANCE_FETCH : 0;
+    unsigned prewarm[2] = { sceneKey | PERM_USE_TEXTURE | fetch, (sceneKey & ~PERM_RECEIVE_SHADOWS) | fetch }; // Cubes, sphere
+    shader_family_prewarm(&sceneShaders, prewarm, 2);
+    shader_family_prewarm(&depthShaders, prewarm, 1);
+    // Sampler units never change
+    shader_family_set_int(&sceneShaders, "texture1", 0);
+    shader_family_set_int(&sceneShaders, "shadowMap", 1);
+    shader_family_set_int(&sceneShaders, "instances", GPU_CULL_INSTANCE_UNIT);
+    shader_family_set_int(&depthShaders, "instances", GPU_CULL_INSTANCE_UNIT);
+
+    // Both meshes go into the shared mesh buffer; every instance into one buffer
+    int cubeMesh = mesh_buffer_add(&mesh_buffer, cube_vertices, sizeof(cube_vertices) / (8 * sizeof(float)),
+                                   cube_indices, sizeof(cube_indices) / sizeof(cube_indices[0]));
+    Mesh sphereData;
+    generate_sphere_mesh(&sphereData, sphere_lat, sphere_lon);
+    int sphereMesh = mesh_buffer_add(&mesh_buffer, sphereData.vertices, sphereData.vertex_count,
+                                     sphereData.indices, sphereData.index_count);
+    free_mesh(&sphereData);
+    GLuint instanceVBO;
+    glGenBuffers(1, &instanceVBO);
+    CullBounds cubeBounds, sphereBounds;
+    memset(&cubeBounds, 0, sizeof(cubeBounds));
+    memset(&sphereBounds, 0, sizeof(sphereBounds));
+    cull_bounds_resize(&sphereBounds, 1);
+    float identity[16];
+    mat4_identity(identity);
+    cull_bounds_set(&sphereBounds, 0, identity, SPHERE_BOUNDING_RADIUS); // Moved every frame
+    if (bvh_enabled) bvh_build(&sphereBounds.bvh, sphereBounds.x, sphereBounds.y, sphereBounds.z, sphereBounds.r, 1);
+    int cubeCount = upload_cube_grid(instanceVBO, cube_grid, &cubeBounds);
+    fit_camera_to_grid(cube_grid);
+    mesh_buffer_upload(&mesh_buffer, instanceVBO);
+    // Batches in instance buffer order, see SPHERE_BATCH
+    const CullBounds* cullBatches[2] = { &sphereBounds, &cubeBounds };
+    if (gpu_cull.enabled && !gpu_cull_supported()) {
+        printf("--gpu-cull needs GL 4.3 and multi-draw indirect, culling on the CPU\n");
+        gpu_cull.enabled = hiz.enabled = 0;
+    }
+    if (gpu_cull.enabled) {
+        gpu_cull_init(&gpu_cull, &mesh_buffer, instanceVBO);
+        gpu_cull_set_objects(&gpu_cull, cullBatches, 2);
+    }
+    if (gpu_cull.enabled && sw_occlusion_enabled) {
+        printf("--sw-occlusion culls on the CPU, ignored with --gpu-cull\n");
+        sw_occlusion_enabled = 0;
+    }
+    if (sw_occlusion_enabled) occlusion_init(&sw_occlusion, sw_occlusion_threads);
+    cull_stats.gpu = gpu_cull.enabled;
+    cull_stats.occlusion = hiz.enabled ? "hiz" : sw_occlusion_enabled ? "software" : "none";
 
     // Load texture
     int tex_w, tex_h, tex_channels;
@@ -417,179 +2431,245 @@ int main(void) {
     glGenerateMipmap(GL_TEXTURE_2D);
     stbi_image_free(tex_data);
 
-    // Sphere VAO/VBO/EBO
-    generate_sphere_mesh();
-    GLuint sphereVAO, sphereVBO, sphereEBO;
-    glGenVertexArrays(1, &sphereVAO);
-    glGenBuffers(1, &sphereVBO);
-    glGenBuffers(1, &sphereEBO);
-    glBindVertexArray(sphereVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, sphereVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(sphere_vertices), sphere_vertices, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(sphere_indices), sphere_indices, GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-    glEnableVertexAttribArray(2);
-    glBindVertexArray(0);
-
     // --- Shadow Map FBO Setup ---
-    glGenFramebuffers(1, &depthMapFBO);
-
-    glGenTextures(1, &depthMap);
-    glBindTexture(GL_TEXTURE_2D, depthMap);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    depthMap = create_depth_array(shadow_size, shadow_cascades);
+    // Hardware depth comparison: each sampler2DArrayShadow fetch returns a
+    // bilinearly filtered 2x2 PCF result
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
     // Clamp to border helps prevent sampling outside the map
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
     float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f }; // Areas outside shadow map are lit
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-
-
-    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0);
-    glDrawBuffer(GL_NONE); // We don't need to draw color data
-    glReadBuffer(GL_NONE);
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-        printf("ERROR::FRAMEBUFFER:: Framebuffer is not complete!\n");
-        glfwTerminate();
-        return -1;
-    }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+    create_layer_fbos(depthMap, shadow_cascades, cascadeFBOs);
+    shadow_cache_init(&static_shadows, shadow_size, shadow_cascades);
     // --- End Shadow Map FBO Setup ---
 
-    double lastTime = glfwGetTime();
-    int nbFrames = 0;
-    char title[64];
+    // --- Offscreen Target Setup (benchmark/stress mode) ---
+    // A headless context may have no default framebuffer, so the main pass
+    // renders into our own FBO instead.
+    GLuint mainFBO = 0, mainColorRBO = 0, mainDepthRBO = 0;
+    float* frame_ms = NULL;
+    if (headless) {
+        glGenFramebuffers(1, &mainFBO);
+        glGenRenderbuffers(1, &mainColorRBO);
+        glGenRenderbuffers(1, &mainDepthRBO);
+        glBindRenderbuffer(GL_RENDERBUFFER, mainColorRBO);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, WINDOW_WIDTH, WINDOW_HEIGHT);
+        glBindRenderbuffer(GL_RENDERBUFFER, mainDepthRBO);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, WINDOW_WIDTH, WINDOW_HEIGHT);
+        glBindFramebuffer(GL_FRAMEBUFFER, mainFBO);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, mainColorRBO);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, mainDepthRBO);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            printf("ERROR::FRAMEBUFFER:: Offscreen framebuffer is not complete!\n");
+            glfwTerminate();
+            return -1;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (bench_frames > 0) frame_ms = (float*)malloc(bench_frames * sizeof(float));
+    }
+    // --- End Offscreen Target Setup ---
 
-    while (!glfwWindowShouldClose(window)) {
-        float t = (float)glfwGetTime();
+    gpu_timers_init();
 
-        // --- Shadow Mapping Pass ---
-        float lightPos[3] = {-5.0f, 10.0f, -3.0f}; // Position the light source
-        float lightProjection[16], lightView[16];
-        float lightSpaceMatrix[16];
-        float near_plane = 1.0f, far_plane = 20.0f;
-        // Using Orthographic projection for directional light
-        mat4_ortho(lightProjection, -15.0f, 15.0f, -15.0f, 15.0f, near_plane, far_plane);
-        mat4_lookAt(lightView, lightPos, (float[3]){0.0f, 0.0f, 0.0f}, (float[3]){0.0f, 1.0f, 0.0f});
-
-        // Matrix multiplication: lightSpaceMatrix = lightProjection * lightView
-        // Simple implementation (replace with a proper matrix mul function if available)
-        //memset(lightSpaceMatrix, 0, sizeof(lightSpaceMatrix));
-        //for(int i=0; i<4; ++i) { // row
-        //    for(int j=0; j<4; ++j) { // col
-        //        for(int k=0; k<4; ++k) {
-        //             lightSpaceMatrix[i*4 + j] += lightProjection[i*4 + k] * lightView[k*4 + j];
-        //        }
-        //    }
-        //}
-        mat4_multiply(lightSpaceMatrix, lightProjection, lightView); // Use helper function
-
-        glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-        glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-        glClear(GL_DEPTH_BUFFER_BIT);
-        glEnable(GL_DEPTH_TEST); // Enable depth testing for depth map generation
-        glEnable(GL_CULL_FACE); // Cull front faces to prevent shadow acne
-        glCullFace(GL_FRONT);
-
-        // Render scene from light's perspective
-        glUseProgram(depthShaderProgram);
-        glUniformMatrix4fv(glGetUniformLocation(depthShaderProgram, "lightSpaceMatrix"), 1, GL_FALSE, lightSpaceMatrix);
-
-        glBindVertexArray(VAO);       // Bind Cube VAO
-        drawCubes(depthShaderProgram); // Render cubes
-        glBindVertexArray(sphereVAO); // Bind Sphere VAO
-        drawSphere(depthShaderProgram); // Render sphere
-        glBindVertexArray(0);         // Unbind VAO
-        glCullFace(GL_BACK); // Restore backface culling
-        glDisable(GL_CULL_FACE);
-
-        glBindFramebuffer(GL_FRAMEBUFFER, 0); // Unbind FBO
-        // --- End Shadow Mapping Pass ---
+    // Per-frame uniform buffer, shared by every program at FRAME_UBO_BINDING
+    FrameUniforms frameUniforms;
+    memset(&frameUniforms, 0, sizeof(frameUniforms));
+    GLuint frameUBO;
+    glGenBuffers(1, &frameUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, frameUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UBO_BINDING, frameUBO);
 
+    double lastTime = glfwGetTime();
+    int nbFrames = 0;
+    char title[256];
+    int frame = 0;
+    int running = 1;
 
-        // --- Main Rendering Pass ---
-        // Reset viewport
-        int display_w, display_h;
-        glfwGetFramebufferSize(window, &display_w, &display_h);
-        glViewport(0, 0, display_w, display_h);
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f); // Set background color
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glEnable(GL_DEPTH_TEST);
+    RenderQueue queue;
+    memset(&queue, 0, sizeof(queue));
 
+    // Setup bound things behind the state cache's back
+    glClearColor(0.1f, 0.1f, 0.1f, 1.0f); // Set background color
+    gl_state_invalidate();
 
-        glUseProgram(shader);
+    StressState stress;
+    memset(&stress, 0, sizeof(stress));
+    if (stress_budget_ms > 0.0f) {
+        stress.count = cubeCount;
+        bench_frames = 0;
+    }
 
-        // Bind shadow map texture to texture unit 1
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, depthMap);
-        glUniform1i(glGetUniformLocation(shader, "shadowMap"), 1);
+    while (running && (headless || !glfwWindowShouldClose(window))) {
+        double frameStart = glfwGetTime();
+        // Headless runs use a fixed timestep so every run renders the same frames
+        float t = headless ? (float)(frame * BENCH_TIMESTEP) : (float)frameStart;
+        if (bench_frames > 0 && frame == BENCH_WARMUP_FRAMES) {
+            gpu_timers_reset();
+            gl_state_reset_totals();
+            cull_stats_reset_totals();
+        }
+        float spherePos[3];
+        updateSphereInstance(instanceVBO, t, spherePos);
+        if (!headless) hot_reload_update();
 
-        // Bind regular texture to texture unit 0
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, tex);
-        glUniform1i(glGetUniformLocation(shader, "texture1"), 0);
+        // --- Per-Frame Uniforms ---
+        float lightPos[3] = {-5.0f, 10.0f, -3.0f}; // Position the light source
 
-        glUniform3f(glGetUniformLocation(shader, "objectColor"), 1.0f, 1.0f, 1.0f); // Default color (overridden in drawCubes or drawSphere)
+        // Light direction (normalized) - Use the same direction derived from lightPos
+        frameUniforms.lightDir[0] = -lightPos[0];
+        frameUniforms.lightDir[1] = -lightPos[1];
+        frameUniforms.lightDir[2] = -lightPos[2];
+        vec3_normalize(frameUniforms.lightDir);
 
         // Matrices (Camera View/Projection)
+        int display_w = WINDOW_WIDTH, display_h = WINDOW_HEIGHT;
+        if (!headless) glfwGetFramebufferSize(window, &display_w, &display_h);
         float aspect = (float)display_w / (float)display_h;
         float fov = 45.0f * 3.1415926f / 180.0f;
-        float znear = 0.1f, zfar = 50.0f;
-        float proj[16];
-        mat4_perspective(proj, fov, aspect, znear, zfar);
+        float znear = 0.1f, zfar = cam_far;
+        mat4_perspective(frameUniforms.projection, fov, aspect, znear, zfar);
         // View matrix (camera)
         float cam_pitch_rad = cam_pitch * 3.1415926f / 180.0f;
         float cam_yaw_rad = cam_yaw * 3.1415926f / 180.0f;
-        float cam_dist_rad = cam_dist * 3.1415926f / 180.0f;
         float cx = cam_dist * cosf(cam_pitch_rad) * sinf(cam_yaw_rad);
         float cy = cam_dist * sinf(cam_pitch_rad);
         float cz = cam_dist * cosf(cam_pitch_rad) * cosf(cam_yaw_rad);
-        float view[16] = {1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1};
         float eye[3] = {cx, cy + 2.0f, cz};
         float center[3] = {0, 0, 0};
         float up[3] = {0, 1, 0};
-        float fwd[3] = {center[0]-eye[0], center[1]-eye[1], center[2]-eye[2]};
-        float fwd_len = sqrtf(fwd[0]*fwd[0]+fwd[1]*fwd[1]+fwd[2]*fwd[2]);
-        for(int i=0;i<3;++i) fwd[i]/=fwd_len;
-        float s[3] = {fwd[1]*up[2]-fwd[2]*up[1], fwd[2]*up[0]-fwd[0]*up[2], fwd[0]*up[1]-fwd[1]*up[0]};
-        float s_len = sqrtf(s[0]*s[0]+s[1]*s[1]+s[2]*s[2]);
-        for(int i=0;i<3;++i) s[i]/=s_len;
-        float u[3] = {s[1]*fwd[2]-s[2]*fwd[1], s[2]*fwd[0]-s[0]*fwd[2], s[0]*fwd[1]-s[1]*fwd[0]};
-        view[0]=s[0]; view[4]=s[1]; view[8]=s[2];
-        view[1]=u[0]; view[5]=u[1]; view[9]=u[2];
-        view[2]=-fwd[0]; view[6]=-fwd[1]; view[10]=-fwd[2];
-        view[12]=-(s[0]*eye[0]+s[1]*eye[1]+s[2]*eye[2]);
-        view[13]=-(u[0]*eye[0]+u[1]*eye[1]+u[2]*eye[2]);
-        view[14]=fwd[0]*eye[0]+fwd[1]*eye[1]+fwd[2]*eye[2];
-        mat4_lookAt(view, eye, center, up); // Use helper function for view matrix
-
-        // Set uniforms
-        // model matrix is set inside drawCubes or drawSphere
-        glUniformMatrix4fv(glGetUniformLocation(shader, "view"), 1, GL_FALSE, view);
-        glUniformMatrix4fv(glGetUniformLocation(shader, "projection"), 1, GL_FALSE, proj);
-        glUniformMatrix4fv(glGetUniformLocation(shader, "lightSpaceMatrix"), 1, GL_FALSE, lightSpaceMatrix); // Pass light space matrix
+        mat4_lookAt(frameUniforms.view, eye, center, up);
+        memcpy(frameUniforms.viewPos, eye, sizeof(eye));
+        compute_cascades(&frameUniforms, eye, center, fov, aspect, znear, zfar);
 
-        // Light direction (normalized) - Use the same direction derived from lightPos
-        float lightDir[3] = {-lightPos[0], -lightPos[1], -lightPos[2]};
-        vec3_normalize(lightDir);
-        glUniform3fv(glGetUniformLocation(shader, "lightDir"), 1, lightDir);
-        glUniform3fv(glGetUniformLocation(shader, "viewPos"), 1, eye); // Pass camera position
+        // The shadow tier picks the shader variant; P switches it at runtime
+        sceneKey = perm_shadow_key(shadow_quality) | normalKey;
+        // Cull against the camera and every cascade's light frustum, then queue the survivors
+        double cullStart = glfwGetTime();
+        CullViews cullViews;
+        cull_views_update(&cullViews, frameUniforms.view, frameUniforms.projection,
+                          frameUniforms.lightSpaceMatrices, shadow_cascades, eye);
+        const CullViews* views = frustum_cull_enabled ? &cullViews : NULL;
+        float sphereModel[16];
+        mat4_identity(sphereModel);
+        memcpy(&sphereModel[12], spherePos, sizeof(spherePos));
+        cull_bounds_set(&sphereBounds, 0, sphereModel, SPHERE_BOUNDING_RADIUS);
+        // The sphere is the only thing that moves; the grid's tree is never refitted
+        if (bvh_enabled)
+            bvh_update(&sphereBounds.bvh, 0, sphereBounds.x[0], sphereBounds.y[0], sphereBounds.z[0], sphereBounds.r[0]);
+        // The cube grid is the only occluder; the sphere is too small to hide much
+        if (sw_occlusion_enabled)
+            occlusion_render_boxes(&sw_occlusion, cullViews.camera_clip, cubeBounds.x, cubeBounds.y, cubeBounds.z,
+                                   CUBE_HALF_SIZE, cubeCount);
+        if (gpu_cull.enabled) gpu_cull_update_object(&gpu_cull, SPHERE_INSTANCE, &sphereBounds, 0);
+        cull_stats.objects = cubeCount + 1;
+        cull_stats.main_visible = cull_stats.shadow_visible = 0;
+        render_queue_reset(&queue);
+        queueCubes(&queue, &sceneShaders, &depthShaders, sceneKey, cubeMesh, tex, &cubeBounds, views, eye);
+        queueSphere(&queue, &sceneShaders, &depthShaders, sceneKey, sphereMesh, &sphereBounds, views, eye);
+        double cullMs = (glfwGetTime() - cullStart) * 1000.0;
+        // GPU culled counts are only known after the frame, see below
+        if (!gpu_cull.enabled) cull_stats_end_frame(cullMs);
+        render_queue_sort(&queue);
+        if (gpu_cull.enabled) {
+            if (hiz.enabled) hiz_resize(&hiz, display_w, display_h);
+            gpu_timer_begin(PASS_CULL, frame);
+            gpu_cull_dispatch(&gpu_cull, &cullViews, shadow_cascades, queue.gpu_commands, queue.indirect_buffer, 0);
+            gpu_timer_end(PASS_CULL, frame);
+            gl_state_bind_texture(GPU_CULL_INSTANCE_UNIT, GL_TEXTURE_BUFFER, gpu_cull.instance_tex);
+        }
 
+        // One buffer write feeds every program through the FrameData block
+        glBindBuffer(GL_UNIFORM_BUFFER, frameUBO);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frameUniforms), &frameUniforms);
+        // --- End Per-Frame Uniforms ---
 
-        // Render scene normally using main shader
-        glBindVertexArray(VAO);       // Bind Cube VAO
-        drawCubes(shader);          // Render cubes
-        glBindVertexArray(sphereVAO); // Bind Sphere VAO
-        drawSphere(shader);          // Render sphere
-        glBindVertexArray(0);         // Unbind VAO
+        // --- Shadow Mapping Pass ---
+        gl_state_viewport(0, 0, shadow_size, shadow_size);
+        gpu_timer_begin(PASS_SHADOW, frame);
+        gl_state_set_capability(GL_DEPTH_TEST, 1); // Enable depth testing for depth map generation
+        gl_state_set_capability(GL_CULL_FACE, 1); // Cull front faces to prevent shadow acne
+        gl_state_cull_face(GL_FRONT);
 
+        // Render scene from light's perspective, once per cascade
+        for (int c = 0; c < shadow_cascades; ++c) {
+            shader_family_set_int(&depthShaders, "cascade", c);
+            gl_state_bind_framebuffer(GL_FRAMEBUFFER, cascadeFBOs[c]);
+            if (shadow_cache_enabled) {
+                // Static casters come from the cache; only re-rendered when the cascade or grid changed
+                if (shadow_cache_begin(&static_shadows, c, frameUniforms.lightSpaceMatrices[c]))
+                    render_queue_submit(&queue, RQ_SHADOW_STATIC(c), RQ_SHADOW_STATIC(c));
+                shadow_cache_blit(&static_shadows, c, cascadeFBOs[c], shadow_size);
+                render_queue_submit(&queue, RQ_SHADOW_DYNAMIC(c), RQ_SHADOW_DYNAMIC(c));
+            } else {
+                glClear(GL_DEPTH_BUFFER_BIT);
+                render_queue_submit(&queue, RQ_SHADOW_STATIC(c), RQ_SHADOW_DYNAMIC(c));
+            }
+        }
+        gl_state_set_capability(GL_CULL_FACE, 0); // The main pass draws both faces
+        gpu_timer_end(PASS_SHADOW, frame);
+
+        gl_state_bind_framebuffer(GL_FRAMEBUFFER, mainFBO); // Back to the main target (0 unless benchmarking)
+        // --- End Shadow Mapping Pass ---
+
+
+        // --- Main Rendering Pass ---
+        // Reset viewport
+        gl_state_viewport(0, 0, display_w, display_h);
+        gpu_timer_begin(PASS_MAIN, frame);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        gl_state_set_capability(GL_DEPTH_TEST, 1);
+
+
+        // Bind shadow map texture to texture unit 1; material textures are
+        // bound to unit 0 by the queue
+        gl_state_bind_texture(1, GL_TEXTURE_2D_ARRAY, depthMap);
+
+        // Camera and light data come from the FrameData block;
+        // model matrix and color are per-instance attributes
+
+        // Render scene normally, sorted by program, texture and mesh
+        render_queue_submit(&queue, RQ_MAIN, RQ_MAIN);
+        gpu_timer_end(PASS_MAIN, frame);
+
+        // Second Hi-Z phase: what the first one hid, retested against this frame's depth
+        if (hiz.enabled) {
+            gpu_timer_begin(PASS_HIZ, frame);
+            hiz_build(&hiz);
+            gpu_cull_dispatch(&gpu_cull, &cullViews, shadow_cascades, queue.gpu_commands, queue.indirect_buffer, 1);
+            render_queue_submit(&queue, RQ_MAIN_LATE, RQ_MAIN_LATE);
+            gpu_timer_end(PASS_HIZ, frame);
+        }
+        gl_state_end_frame();
+
+        if (headless) {
+            // Wait for the GPU so the sample covers the whole frame
+            glFinish();
+            float ms = (float)((glfwGetTime() - frameStart) * 1000.0);
+            if (gpu_cull.enabled) {
+                gpu_cull_read_stats(&gpu_cull, shadow_cascades, queue.gpu_commands, queue.indirect_buffer);
+                cull_stats_end_frame(cullMs);
+            }
+            if (bench_frames > 0) {
+                if (frame >= BENCH_WARMUP_FRAMES) frame_ms[frame - BENCH_WARMUP_FRAMES] = ms;
+                running = frame + 1 < BENCH_WARMUP_FRAMES + bench_frames;
+            } else if (stress_record_frame(&stress, ms)) {
+                cubeCount = upload_cube_grid(instanceVBO, cube_grid, &cubeBounds);
+                if (gpu_cull.enabled) gpu_cull_set_objects(&gpu_cull, cullBatches, 2);
+                shadow_cache_invalidate(&static_shadows);
+                fit_camera_to_grid(cube_grid);
+            } else {
+                running = !stress.done;
+            }
+            frame++;
+            continue;
+        }
+        frame++;
 
         glfwSwapBuffers(window);
         glfwPollEvents();
@@ -598,24 +2678,59 @@ int main(void) {
         nbFrames++;
         double currentTime = glfwGetTime();
         if (currentTime - lastTime >= 1.0) {
-            snprintf(title, sizeof(title), "Rotating 3D Cube [FPS: %d]", nbFrames);
+            // One stalling readback a second for the title
+            if (gpu_cull.enabled)
+                gpu_cull_read_stats(&gpu_cull, shadow_cascades, queue.gpu_commands, queue.indirect_buffer);
+            snprintf(title, sizeof(title),
+                     "Rotating 3D Cube [FPS: %d | GPU shadow %.2f ms, main %.2f ms | PCF %s | GL calls %d, elided %d"
+                     " | visible %d/%d, shadow casters %d]",
+                     nbFrames, gpu_timer_average_ms(PASS_SHADOW), gpu_timer_average_ms(PASS_MAIN),
+                     shadow_quality_names[shadow_quality], gl_state.last_issued, gl_state.last_elided,
+                     cull_stats.main_visible, cull_stats.objects, cull_stats.shadow_visible);
             glfwSetWindowTitle(window, title);
             nbFrames = 0;
             lastTime += 1.0;
         }
     }
 
+    if (headless) {
+        if (bench_frames > 0) {
+            gpu_timers_drain();
+            startup_times.programs_ms = program_load_ms;
+            startup_times.cache_hits = program_cache_hits;
+            startup_times.cache_misses = program_cache_misses;
+            startup_times.parallel_compile = parallel_compile;
+            startup_times.variants =
+                shader_family_variant_count(&sceneShaders) + shader_family_variant_count(&depthShaders);
+            ShaderFamily* families[2] = { &sceneShaders, &depthShaders };
+            measure_program_startup(&startup_times, families, 2);
+            print_bench_report(frame_ms, bench_frames);
+            free(frame_ms);
+        } else {
+            print_stress_report(&stress);
+        }
+        glDeleteFramebuffers(1, &mainFBO);
+        glDeleteRenderbuffers(1, &mainColorRBO);
+        glDeleteRenderbuffers(1, &mainDepthRBO);
+    }
+
     // Cleanup
-    glDeleteFramebuffers(1, &depthMapFBO);
+    gpu_timers_cleanup();
+    glDeleteBuffers(1, &frameUBO);
+    glDeleteFramebuffers(shadow_cascades, cascadeFBOs);
     glDeleteTextures(1, &depthMap);
-    glDeleteProgram(depthShaderProgram);
-    glDeleteProgram(shader);
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
-    glDeleteBuffers(1, &EBO);
-    glDeleteVertexArrays(1, &sphereVAO);
-    glDeleteBuffers(1, &sphereVBO);
-    glDeleteBuffers(1, &sphereEBO);
+    shadow_cache_cleanup(&static_shadows);
+    render_queue_free(&queue);
+    gpu_cull_cleanup(&gpu_cull);
+    hiz_cleanup(&hiz);
+    if (sw_occlusion_enabled) occlusion_free(&sw_occlusion);
+    cull_bounds_free(&cubeBounds);
+    cull_bounds_free(&sphereBounds);
+    hot_reload_cleanup();
+    shader_family_cleanup(&depthShaders);
+    shader_family_cleanup(&sceneShaders);
+    mesh_buffer_cleanup(&mesh_buffer);
+    glDeleteBuffers(1, &instanceVBO);
     glDeleteTextures(1, &tex);
 
     glfwTerminate();
@@ -0,0 +1,543 @@
+/* occlusion.h - multi-threaded software depth rasterizer for occlusion culling
+
+   Do this:
+      #define OCCLUSION_IMPLEMENTATION
+   before you include this file in *one* C file to create the implementation.
+   Link with -pthread (Windows uses its own threads).
+
+   Occluders (axis-aligned boxes) are drawn into a small depth buffer, then
+   occludee boxes are tested against it before their draws are issued. It all
+   runs on the CPU, so there is no readback latency and it behaves the same
+   on a software GL as on a real GPU.
+
+   A pool of worker threads runs three fork-join steps: transforming the
+   occluders, rasterizing them (each task owns a band of rows, so no two
+   threads write the same pixel) and testing the occludees. Occluders are
+   drawn roughly front to back, and one already hidden within a band is
+   skipped there; each front face is filled as one quad. Rows are filled
+   and tested 4 (SSE) or 8 (AVX) pixels at a time, picked like vecmath.h.
+
+   Pixels are sampled at their centers: an occluder covers a pixel once it
+   covers the center, so culling is approximate along occluder silhouettes.
+   Occludees are conservative otherwise: every pixel their projected box
+   touches has to hold a nearer occluder.
+*/
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+#define OCCLUSION_MAX_THREADS 16
+
+typedef struct OcclusionPool OcclusionPool;
+
+typedef struct {
+    float* depth;       // OCCLUSION_WIDTH x OCCLUSION_HEIGHT window depths, row 0 at the bottom; 1 = empty
+    float clip[16];     // Projection * view of the last render
+    int threads;        // Including the calling thread
+    int occluders;      // Boxes rasterized by the last render
+    float* corners;     // Per box: 8 projected corners (x, y, depth)
+    int* rect;          // Per box: first/last pixel column and row; column -1 when not drawn
+    float* nearest;     // Per box: nearest corner depth
+    float* distance;    // Per box: view depth of the center, the drawing order key
+    int* order;         // The drawn boxes, front to back
+    int capacity;
+    OcclusionPool* pool;
+} OcclusionBuffer;
+
+// threads <= 0 uses one per CPU
+void occlusion_init(OcclusionBuffer* ob, int threads);
+void occlusion_free(OcclusionBuffer* ob);
+// Clears the buffer and rasterizes n boxes (SoA centers x/y/z, all with
+// half size half) as seen through clip (projection * view)
+void occlusion_render_boxes(OcclusionBuffer* ob, const float* clip, const float* x, const float* y,
+                            const float* z, float half, int n);
+// Clears visible[i] for every box i still set (centers x/y/z, half sizes
+// half) that lies behind the occluders of the last render; returns the
+// number left visible
+int  occlusion_test_boxes(OcclusionBuffer* ob, unsigned char* visible, const float* x, const float* y,
+                          const float* z, const float* half, int n);
+
+#endif // OCCLUSION_H
+
+#ifdef OCCLUSION_IMPLEMENTATION
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX__)
+#define OCCLUSION_AVX
+#include <immintrin.h>
+#endif
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define OCCLUSION_SSE
+#include <xmmintrin.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE occlusion_thread;
+typedef CRITICAL_SECTION occlusion_mutex;
+typedef CONDITION_VARIABLE occlusion_cond;
+#define occlusion_mutex_init(m) InitializeCriticalSection(m)
+#define occlusion_mutex_destroy(m) DeleteCriticalSection(m)
+#define occlusion_lock(m) EnterCriticalSection(m)
+#define occlusion_unlock(m) LeaveCriticalSection(m)
+#define occlusion_cond_init(c) InitializeConditionVariable(c)
+#define occlusion_cond_destroy(c) ((void)0)
+#define occlusion_wait(c, m) SleepConditionVariableCS(c, m, INFINITE)
+#define occlusion_wake_all(c) WakeAllConditionVariable(c)
+#else
+#include <pthread.h>
+#include <unistd.h>
+typedef pthread_t occlusion_thread;
+typedef pthread_mutex_t occlusion_mutex;
+typedef pthread_cond_t occlusion_cond;
+#define occlusion_mutex_init(m) pthread_mutex_init(m, NULL)
+#define occlusion_mutex_destroy(m) pthread_mutex_destroy(m)
+#define occlusion_lock(m) pthread_mutex_lock(m)
+#define occlusion_unlock(m) pthread_mutex_unlock(m)
+#define occlusion_cond_init(c) pthread_cond_init(c, NULL)
+#define occlusion_cond_destroy(c) pthread_cond_destroy(c)
+#define occlusion_wait(c, m) pthread_cond_wait(c, m)
+#define occlusion_wake_all(c) pthread_cond_broadcast(c)
+#endif
+
+#define OCCLUSION_BAND_ROWS 8        // Rows per rasterization task
+#define OCCLUSION_BOXES_PER_TASK 512 // Boxes per transform / test task
+#define OCCLUSION_PADDING 8          // Floats after the buffer, so row tails can load a full vector
+#define OCCLUSION_SORT_BUCKETS 1024  // Depth buckets of the front-to-back order
+
+// Workers sleep on `wake` until a job has tasks left; the caller takes
+// tasks as well and then waits on `done` for the stragglers
+struct OcclusionPool {
+    occlusion_thread threads[OCCLUSION_MAX_THREADS];
+    int count;
+    occlusion_mutex lock;
+    occlusion_cond wake, done;
+    void (*task)(OcclusionPool* p, int index);
+    int next, total, finished, quit;
+    // The job's arguments
+    OcclusionBuffer* ob;
+    const float *x, *y, *z, *half;
+    float box_half;
+    unsigned char* visible;
+    int n;
+};
+
+// Runs tasks until none are left; called with the lock held
+static void occlusion_run_tasks(OcclusionPool* p) {
+    while (p->next < p->total) {
+        int index = p->next++;
+        occlusion_unlock(&p->lock);
+        p->task(p, index);
+        occlusion_lock(&p->lock);
+        if (++p->finished == p->total) occlusion_wake_all(&p->done);
+    }
+}
+
+static void occlusion_worker_loop(OcclusionPool* p) {
+    occlusion_lock(&p->lock);
+    for (;;) {
+        while (!p->quit && p->next >= p->total) occlusion_wait(&p->wake, &p->lock);
+        if (p->quit) break;
+        occlusion_run_tasks(p);
+    }
+    occlusion_unlock(&p->lock);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI occlusion_worker(LPVOID arg) {
+    occlusion_worker_loop((OcclusionPool*)arg);
+    return 0;
+}
+#else
+static void* occlusion_worker(void* arg) {
+    occlusion_worker_loop((OcclusionPool*)arg);
+    return NULL;
+}
+#endif
+
+// Runs task(p, 0..count-1) across the pool and returns once all are done
+static void occlusion_parallel(OcclusionPool* p, void (*task)(OcclusionPool* p, int index), int count) {
+    if (count <= 1 || p->count == 0) {
+        for (int i = 0; i < count; ++i) task(p, i);
+        return;
+    }
+    occlusion_lock(&p->lock);
+    p->task = task;
+    p->next = p->finished = 0;
+    p->total = count;
+    occlusion_wake_all(&p->wake);
+    occlusion_run_tasks(p);
+    while (p->finished < p->total) occlusion_wait(&p->done, &p->lock);
+    occlusion_unlock(&p->lock);
+}
+
+static int occlusion_cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+void occlusion_init(OcclusionBuffer* ob, int threads) {
+    memset(ob, 0, sizeof(*ob));
+    if (threads <= 0) threads = occlusion_cpu_count();
+    if (threads > OCCLUSION_MAX_THREADS) threads = OCCLUSION_MAX_THREADS;
+    ob->threads = threads;
+    ob->depth = (float*)malloc((OCCLUSION_WIDTH * OCCLUSION_HEIGHT + OCCLUSION_PADDING) * sizeof(float));
+    ob->pool = (OcclusionPool*)calloc(1, sizeof(OcclusionPool));
+    if (!ob->depth || !ob->pool) {
+        printf("Out of memory for the occlusion buffer\n");
+        exit(1);
+    }
+    for (int i = 0; i < OCCLUSION_WIDTH * OCCLUSION_HEIGHT + OCCLUSION_PADDING; ++i) ob->depth[i] = 1.0f;
+    OcclusionPool* p = ob->pool;
+    p->ob = ob;
+    occlusion_mutex_init(&p->lock);
+    occlusion_cond_init(&p->wake);
+    occlusion_cond_init(&p->done);
+    for (int i = 0; i < threads - 1; ++i) {
+#ifdef _WIN32
+        p->threads[p->count] = CreateThread(NULL, 0, occlusion_worker, p, 0, NULL);
+        if (!p->threads[p->count]) break;
+#else
+        if (pthread_create(&p->threads[p->count], NULL, occlusion_worker, p) != 0) break;
+#endif
+        p->count++;
+    }
+    ob->threads = p->count + 1;
+}
+
+void occlusion_free(OcclusionBuffer* ob) {
+    OcclusionPool* p = ob->pool;
+    if (p) {
+        occlusion_lock(&p->lock);
+        p->quit = 1;
+        occlusion_wake_all(&p->wake);
+        occlusion_unlock(&p->lock);
+        for (int i = 0; i < p->count; ++i) {
+#ifdef _WIN32
+            WaitForSingleObject(p->threads[i], INFINITE);
+            CloseHandle(p->threads[i]);
+#else
+            pthread_join(p->threads[i], NULL);
+#endif
+        }
+        occlusion_cond_destroy(&p->done);
+        occlusion_cond_destroy(&p->wake);
+        occlusion_mutex_destroy(&p->lock);
+        free(p);
+    }
+    free(ob->depth);
+    free(ob->corners);
+    free(ob->rect);
+    free(ob->nearest);
+    free(ob->distance);
+    free(ob->order);
+    memset(ob, 0, sizeof(*ob));
+}
+
+// Projects the 8 corners of the box (center c, half size h) to window
+// coordinates: pixels in x/y, depth in [0, 1]. Returns 0 when a corner
+// lies in front of the near plane.
+static int occlusion_project_box(float out[8][3], float* distance, const float* clip, const float* c, float h) {
+    float center[4];
+    for (int i = 0; i < 4; ++i) center[i] = clip[i] * c[0] + clip[4 + i] * c[1] + clip[8 + i] * c[2] + clip[12 + i];
+    for (int k = 0; k < 8; ++k) {
+        float sx = (k & 1) ? h : -h, sy = (k & 2) ? h : -h, sz = (k & 4) ? h : -h;
+        float p[4];
+        for (int i = 0; i < 4; ++i) p[i] = center[i] + clip[i] * sx + clip[4 + i] * sy + clip[8 + i] * sz;
+        if (p[2] < -p[3] || p[3] <= 0.0f) return 0;
+        float inv = 1.0f / p[3];
+        out[k][0] = (p[0] * inv * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+        out[k][1] = (p[1] * inv * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+        out[k][2] = p[2] * inv * 0.5f + 0.5f;
+    }
+    *distance = center[3];
+    return 1;
+}
+
+// First and last pixel whose center lies in [lo, hi], clamped to [0, size)
+static int occlusion_pixel_span(float lo, float hi, int size, int* first, int* last) {
+    *first = (int)ceilf(lo - 0.5f);
+    *last = (int)floorf(hi - 0.5f);
+    if (*first < 0) *first = 0;
+    if (*last > size - 1) *last = size - 1;
+    return *first <= *last;
+}
+
+static void occlusion_transform_task(OcclusionPool* p, int index) {
+    OcclusionBuffer* ob = p->ob;
+    int end = (index + 1) * OCCLUSION_BOXES_PER_TASK;
+    if (end > p->n) end = p->n;
+    for (int i = index * OCCLUSION_BOXES_PER_TASK; i < end; ++i) {
+        float(*corners)[3] = (float(*)[3])(ob->corners + i * 24);
+        float c[3] = { p->x[i], p->y[i], p->z[i] };
+        int* rect = ob->rect + i * 4;
+        rect[0] = -1;
+        if (!occlusion_project_box(corners, &ob->distance[i], ob->clip, c, p->box_half)) continue;
+        float lo[3] = { corners[0][0], corners[0][1], corners[0][2] }, hi[2] = { corners[0][0], corners[0][1] };
+        for (int k = 1; k < 8; ++k) {
+            for (int a = 0; a < 3; ++a)
+                if (corners[k][a] < lo[a]) lo[a] = corners[k][a];
+            for (int a = 0; a < 2; ++a)
+                if (corners[k][a] > hi[a]) hi[a] = corners[k][a];
+        }
+        // Boxes that cover no pixel center are skipped
+        if (!occlusion_pixel_span(lo[0], hi[0], OCCLUSION_WIDTH, &rect[0], &rect[1]) ||
+            !occlusion_pixel_span(lo[1], hi[1], OCCLUSION_HEIGHT, &rect[2], &rect[3])) {
+            rect[0] = -1;
+            continue;
+        }
+        ob->nearest[i] = lo[2];
+    }
+}
+
+// 1 if every pixel in columns [x0, x1] and rows [y0, y1] holds a depth
+// nearer than nearest
+static int occlusion_rect_hidden(const float* depth, int x0, int x1, int y0, int y1, float nearest) {
+    for (int y = y0; y <= y1; ++y) {
+        const float* row = depth + y * OCCLUSION_WIDTH;
+        int x = x0;
+#if defined(OCCLUSION_AVX)
+        {
+            __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+            for (; x <= x1; x += 8) {
+                __m256 in = _mm256_cmp_ps(_mm256_add_ps(_mm256_set1_ps((float)x), lane), _mm256_set1_ps((float)x1),
+                                          _CMP_LE_OQ);
+                __m256 open = _mm256_cmp_ps(_mm256_loadu_ps(row + x), _mm256_set1_ps(nearest), _CMP_GE_OQ);
+                if (_mm256_movemask_ps(_mm256_and_ps(in, open))) return 0;
+            }
+        }
+#elif defined(OCCLUSION_SSE)
+        {
+            __m128 lane = _mm_setr_ps(0, 1, 2, 3);
+            for (; x <= x1; x += 4) {
+                __m128 in = _mm_cmple_ps(_mm_add_ps(_mm_set1_ps((float)x), lane), _mm_set1_ps((float)x1));
+                __m128 open = _mm_cmpge_ps(_mm_loadu_ps(row + x), _mm_set1_ps(nearest));
+                if (_mm_movemask_ps(_mm_and_ps(in, open))) return 0;
+            }
+        }
+#endif
+        for (; x <= x1; ++x)
+            if (row[x] >= nearest) return 0;
+    }
+    return 1;
+}
+
+// Counter-clockwise (outward) corner quads of the 6 faces; corner k is at
+// center + half * (k & 1 ? +x : -x, k & 2 ? +y : -y, k & 4 ? +z : -z)
+static const unsigned char occlusion_box_faces[6][4] = {
+    { 0, 4, 6, 2 }, { 1, 3, 7, 5 }, { 0, 1, 5, 4 }, { 2, 6, 7, 3 }, { 0, 2, 3, 1 }, { 4, 5, 7, 6 },
+};
+
+// Fills the face's pixels in rows [rowFirst, rowLast] where it is nearer
+// than the buffer; back faces (clockwise on screen) are skipped. A projected
+// box face is a convex quad with depth affine over it, so the plane through
+// its first three corners covers all of it.
+static void occlusion_draw_face(float* depth, const float* const v[4], int rowFirst, int rowLast) {
+    const float *a = v[0], *b = v[1], *c = v[2];
+    float area = (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+    if (area <= 1e-8f) return;
+    float lo[2] = { a[0], a[1] }, hi[2] = { a[0], a[1] };
+    for (int k = 1; k < 4; ++k) {
+        for (int i = 0; i < 2; ++i) {
+            if (v[k][i] < lo[i]) lo[i] = v[k][i];
+            if (v[k][i] > hi[i]) hi[i] = v[k][i];
+        }
+    }
+    int x0, x1, y0, y1;
+    if (!occlusion_pixel_span(lo[0], hi[0], OCCLUSION_WIDTH, &x0, &x1) ||
+        !occlusion_pixel_span(lo[1], hi[1], OCCLUSION_HEIGHT, &y0, &y1))
+        return;
+    if (y0 < rowFirst) y0 = rowFirst;
+    if (y1 > rowLast) y1 = rowLast;
+    // Edge functions e = ex * px + ey * py + ec, >= 0 inside, and the depth plane
+    float ex[4], ey[4], ec[4];
+    for (int e = 0; e < 4; ++e) {
+        const float* p0 = v[e];
+        const float* p1 = v[(e + 1) & 3];
+        ex[e] = p0[1] - p1[1];
+        ey[e] = p1[0] - p0[0];
+        ec[e] = -(ex[e] * p0[0] + ey[e] * p0[1]);
+    }
+    float inv = 1.0f / area;
+    float zx = ((b[2] - a[2]) * (c[1] - a[1]) - (c[2] - a[2]) * (b[1] - a[1])) * inv;
+    float zy = ((c[2] - a[2]) * (b[0] - a[0]) - (b[2] - a[2]) * (c[0] - a[0])) * inv;
+    float zc = a[2] - zx * a[0] - zy * a[1];
+    float xFirst = x0 + 0.5f, xLast = x1 + 0.5f;
+    for (int y = y0; y <= y1; ++y) {
+        float py = y + 0.5f;
+        float r[4];
+        for (int e = 0; e < 4; ++e) r[e] = ey[e] * py + ec[e];
+        float rz = zy * py + zc;
+        float* row = depth + y * OCCLUSION_WIDTH;
+        int x = x0;
+#if defined(OCCLUSION_AVX)
+        {
+            __m256 zero = _mm256_setzero_ps();
+            __m256 lane = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+            for (x &= ~7; x <= x1; x += 8) {
+                __m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), lane);
+                __m256 in = _mm256_and_ps(_mm256_cmp_ps(px, _mm256_set1_ps(xFirst), _CMP_GE_OQ),
+                                          _mm256_cmp_ps(px, _mm256_set1_ps(xLast), _CMP_LE_OQ));
+                for (int e = 0; e < 4; ++e) {
+                    __m256 d = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(ex[e]), px), _mm256_set1_ps(r[e]));
+                    in = _mm256_and_ps(in, _mm256_cmp_ps(d, zero, _CMP_GE_OQ));
+                }
+                __m256 z = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(zx), px), _mm256_set1_ps(rz));
+                __m256 old = _mm256_loadu_ps(row + x);
+                in = _mm256_and_ps(in, _mm256_cmp_ps(z, old, _CMP_LT_OQ));
+                _mm256_storeu_ps(row + x, _mm256_blendv_ps(old, z, in));
+            }
+        }
+#elif defined(OCCLUSION_SSE)
+        {
+            __m128 zero = _mm_setzero_ps();
+            __m128 lane = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+            for (x &= ~3; x <= x1; x += 4) {
+                __m128 px = _mm_add_ps(_mm_set1_ps((float)x), lane);
+                __m128 in = _mm_and_ps(_mm_cmpge_ps(px, _mm_set1_ps(xFirst)), _mm_cmple_ps(px, _mm_set1_ps(xLast)));
+                for (int e = 0; e < 4; ++e) {
+                    __m128 d = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ex[e]), px), _mm_set1_ps(r[e]));
+                    in = _mm_and_ps(in, _mm_cmpge_ps(d, zero));
+                }
+                __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(zx), px), _mm_set1_ps(rz));
+                __m128 old = _mm_loadu_ps(row + x);
+                in = _mm_and_ps(in, _mm_cmplt_ps(z, old));
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(in, z), _mm_andnot_ps(in, old)));
+            }
+        }
+#endif
+        for (; x <= x1; ++x) {
+            float px = x + 0.5f;
+            if (ex[0] * px + r[0] < 0.0f || ex[1] * px + r[1] < 0.0f || ex[2] * px + r[2] < 0.0f ||
+                ex[3] * px + r[3] < 0.0f)
+                continue;
+            float z = zx * px + rz;
+            if (z < row[x]) row[x] = z;
+        }
+    }
+}
+
+// Draws every box that touches the band, front to back. A box whose pixels
+// in the band are all nearer already could not change any of them.
+static void occlusion_raster_task(OcclusionPool* p, int index) {
+    OcclusionBuffer* ob = p->ob;
+    int rowFirst = index * OCCLUSION_BAND_ROWS, rowLast = rowFirst + OCCLUSION_BAND_ROWS - 1;
+    for (int y = rowFirst; y <= rowLast; ++y)
+        for (int x = 0; x < OCCLUSION_WIDTH; ++x) ob->depth[y * OCCLUSION_WIDTH + x] = 1.0f;
+    for (int k = 0; k < ob->occluders; ++k) {
+        int i = ob->order[k];
+        const int* rect = ob->rect + i * 4;
+        if (rect[2] > rowLast || rect[3] < rowFirst) continue;
+        int y0 = rect[2] > rowFirst ? rect[2] : rowFirst, y1 = rect[3] < rowLast ? rect[3] : rowLast;
+        if (occlusion_rect_hidden(ob->depth, rect[0], rect[1], y0, y1, ob->nearest[i])) continue;
+        const float(*corners)[3] = (const float(*)[3])(ob->corners + i * 24);
+        for (int f = 0; f < 6; ++f) {
+            const unsigned char* q = occlusion_box_faces[f];
+            const float* face[4] = { corners[q[0]], corners[q[1]], corners[q[2]], corners[q[3]] };
+            occlusion_draw_face(ob->depth, face, rowFirst, rowLast);
+        }
+    }
+}
+
+void occlusion_render_boxes(OcclusionBuffer* ob, const float* clip, const float* x, const float* y,
+                            const float* z, float half, int n) {
+    if (n > ob->capacity) {
+        ob->corners = (float*)realloc(ob->corners, n * 24 * sizeof(float));
+        ob->rect = (int*)realloc(ob->rect, n * 4 * sizeof(int));
+        ob->nearest = (float*)realloc(ob->nearest, n * sizeof(float));
+        ob->distance = (float*)realloc(ob->distance, n * sizeof(float));
+        ob->order = (int*)realloc(ob->order, n * sizeof(int));
+        if (!ob->corners || !ob->rect || !ob->nearest || !ob->distance || !ob->order) {
+            printf("Out of memory for %d occluders\n", n);
+            exit(1);
+        }
+        ob->capacity = n;
+    }
+    memcpy(ob->clip, clip, sizeof(ob->clip));
+    OcclusionPool* p = ob->pool;
+    p->x = x;
+    p->y = y;
+    p->z = z;
+    p->box_half = half;
+    p->n = n;
+    occlusion_parallel(p, occlusion_transform_task, (n + OCCLUSION_BOXES_PER_TASK - 1) / OCCLUSION_BOXES_PER_TASK);
+    // Counting sort of the drawn boxes into depth buckets; the order only
+    // has to be rough for nearer boxes to hide the ones behind them
+    float lo = 0.0f, hi = 0.0f;
+    int drawn = 0;
+    for (int i = 0; i < n; ++i) {
+        if (ob->rect[i * 4] < 0) continue;
+        float d = ob->distance[i];
+        if (!drawn || d < lo) lo = d;
+        if (!drawn || d > hi) hi = d;
+        drawn++;
+    }
+    int start[OCCLUSION_SORT_BUCKETS + 1] = { 0 };
+    float scale = hi > lo ? (OCCLUSION_SORT_BUCKETS - 1) / (hi - lo) : 0.0f;
+    for (int i = 0; i < n; ++i)
+        if (ob->rect[i * 4] >= 0) start[(int)((ob->distance[i] - lo) * scale) + 1]++;
+    for (int b = 0; b < OCCLUSION_SORT_BUCKETS; ++b) start[b + 1] += start[b];
+    for (int i = 0; i < n; ++i)
+        if (ob->rect[i * 4] >= 0) ob->order[start[(int)((ob->distance[i] - lo) * scale)]++] = i;
+    ob->occluders = drawn;
+    occlusion_parallel(p, occlusion_raster_task, OCCLUSION_HEIGHT / OCCLUSION_BAND_ROWS);
+}
+
+// 1 if every pixel the box's screen rectangle touches holds an occluder
+// nearer than the box's nearest corner
+static int occlusion_box_hidden(const OcclusionBuffer* ob, const float* c, float h) {
+    float corners[8][3], distance;
+    if (!occlusion_project_box(corners, &distance, ob->clip, c, h)) return 0;
+    float lo[3] = { corners[0][0], corners[0][1], corners[0][2] };
+    float hi[2] = { corners[0][0], corners[0][1] };
+    for (int k = 1; k < 8; ++k) {
+        for (int a = 0; a < 3; ++a)
+            if (corners[k][a] < lo[a]) lo[a] = corners[k][a];
+        for (int a = 0; a < 2; ++a)
+            if (corners[k][a] > hi[a]) hi[a] = corners[k][a];
+    }
+    int x0 = (int)floorf(lo[0]), x1 = (int)floorf(hi[0]);
+    int y0 = (int)floorf(lo[1]), y1 = (int)floorf(hi[1]);
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > OCCLUSION_WIDTH - 1) x1 = OCCLUSION_WIDTH - 1;
+    if (y1 > OCCLUSION_HEIGHT - 1) y1 = OCCLUSION_HEIGHT - 1;
+    if (x0 > x1 || y0 > y1) return 0; // Off screen: left to the frustum test
+    return occlusion_rect_hidden(ob->depth, x0, x1, y0, y1, lo[2]);
+}
+
+static void occlusion_test_task(OcclusionPool* p, int index) {
+    int end = (index + 1) * OCCLUSION_BOXES_PER_TASK;
+    if (end > p->n) end = p->n;
+    for (int i = index * OCCLUSION_BOXES_PER_TASK; i < end; ++i) {
+        float c[3] = { p->x[i], p->y[i], p->z[i] };
+        if (p->visible[i] && occlusion_box_hidden(p->ob, c, p->half[i])) p->visible[i] = 0;
+    }
+}
+
+int occlusion_test_boxes(OcclusionBuffer* ob, unsigned char* visible, const float* x, const float* y,
+                         const float* z, const float* half, int n) {
+    OcclusionPool* p = ob->pool;
+    p->x = x;
+    p->y = y;
+    p->z = z;
+    p->half = half;
+    p->visible = visible;
+    p->n = n;
+    occlusion_parallel(p, occlusion_test_task, (n + OCCLUSION_BOXES_PER_TASK - 1) / OCCLUSION_BOXES_PER_TASK);
+    int count = 0;
+    for (int i = 0; i < n; ++i) count += visible[i];
+    return count;
+}
+
+#endif // OCCLUSION_IMPLEMENTATION
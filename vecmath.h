@@ -0,0 +1,311 @@
+/* vecmath.h - 4x4 matrix / vector helpers with SSE and AVX paths
+
+   Do this:
+      #define VECMATH_IMPLEMENTATION
+   before you include this file in *one* C file to create the implementation.
+
+   Matrices are 16 floats in OpenGL (column-major) order, passed as float* so
+   plain arrays keep working. The mat4/vec4 types are 16-byte aligned for
+   mat4_transform_points, which uses aligned loads; the multiplies load
+   unaligned, so they take any float array.
+
+   SIMD paths are picked at compile time: SSE is used on x86-64 (or whenever
+   __SSE__ is defined), AVX when built with -mavx/-mavx2 (or /arch:AVX),
+   otherwise the scalar code. Define VECMATH_NO_SIMD to force the scalar
+   code. All paths sum in the same order, so without FMA contraction they
+   produce the same bits as the scalar fallback.
+*/
+#ifndef VECMATH_H
+#define VECMATH_H
+
+typedef struct { _Alignas(16) float m[16]; } mat4;
+typedef struct { _Alignas(16) float v[4]; } vec4;
+
+void  mat4_identity(float* m);
+void  vec3_cross(float* out, const float* a, const float* b);
+float vec3_dot(const float* a, const float* b);
+void  vec3_normalize(float* v);
+void  mat4_lookAt(float* out, const float* eye, const float* center, const float* up);
+void  mat4_ortho(float* out, float left, float right, float bottom, float top, float nearVal, float farVal);
+void  mat4_perspective(float* out, float fovy, float aspect, float nearVal, float farVal);
+// out[i*4+j] = sum_k a[i*4+k] * b[k*4+j]; out may alias a or b
+void  mat4_multiply(float* out, const float* a, const float* b);
+void  mat4_normal_matrix(float* out, const float* m);
+
+// Batched: out[i] = mat4_multiply(a, b[i]) for n matrices; out may alias b
+void  mat4_multiply_batch(mat4* out, const mat4* a, const mat4* b, int n);
+// Batched: out[i] = M * in[i] (column vectors, OpenGL convention); out may alias in
+void  mat4_transform_points(vec4* out, const mat4* m, const vec4* in, int n);
+
+// The 6 clip planes (left, right, bottom, top, near, far) of a clip matrix
+// such as proj * view, as (a, b, c, d) with a*x + b*y + c*z + d >= 0 inside,
+// normalized so d is a distance
+void  frustum_planes(float planes[6][4], const float* clip);
+// visible[i] = 1 if sphere i (SoA centers x/y/z, radii r) touches the
+// frustum, else 0; returns the number visible. Tests 4 (SSE) or 8 (AVX)
+// spheres per instruction.
+int   frustum_cull_spheres(unsigned char* visible, const float planes[6][4], const float* x, const float* y,
+                           const float* z, const float* r, int n);
+
+#endif // VECMATH_H
+
+#ifdef VECMATH_IMPLEMENTATION
+#include <math.h>
+#include <string.h>
+
+#if defined(__AVX__) && !defined(VECMATH_NO_SIMD)
+#define VECMATH_AVX
+#include <immintrin.h>
+#endif
+#if (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)) && !defined(VECMATH_NO_SIMD)
+#define VECMATH_SSE
+#include <xmmintrin.h>
+#endif
+
+void mat4_identity(float* m) {
+    memset(m, 0, 16 * sizeof(float));
+    m[0] = m[5] = m[10] = m[15] = 1.0f;
+}
+
+void vec3_cross(float* out, const float* a, const float* b) {
+    float x = a[1] * b[2] - a[2] * b[1];
+    float y = a[2] * b[0] - a[0] * b[2];
+    float z = a[0] * b[1] - a[1] * b[0];
+    out[0] = x;
+    out[1] = y;
+    out[2] = z;
+}
+
+float vec3_dot(const float* a, const float* b) {
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+void vec3_normalize(float* v) {
+    float len = sqrtf(vec3_dot(v, v));
+    if (len > 1e-6f) {
+        v[0] /= len;
+        v[1] /= len;
+        v[2] /= len;
+    }
+}
+
+void mat4_lookAt(float* out, const float* eye, const float* center, const float* up) {
+    float f[3], s[3], u[3];
+    f[0] = center[0] - eye[0]; f[1] = center[1] - eye[1]; f[2] = center[2] - eye[2];
+    vec3_normalize(f);
+    vec3_cross(s, f, up);
+    vec3_normalize(s);
+    vec3_cross(u, s, f); // No need to normalize u if s and f are orthonormal
+
+    mat4_identity(out);
+    out[0] = s[0];  out[4] = s[1];  out[8] = s[2];
+    out[1] = u[0];  out[5] = u[1];  out[9] = u[2];
+    out[2] = -f[0]; out[6] = -f[1]; out[10] = -f[2];
+    out[12] = -vec3_dot(s, eye);
+    out[13] = -vec3_dot(u, eye);
+    out[14] = vec3_dot(f, eye);
+}
+
+void mat4_ortho(float* out, float left, float right, float bottom, float top, float nearVal, float farVal) {
+    mat4_identity(out);
+    out[0] = 2.0f / (right - left);
+    out[5] = 2.0f / (top - bottom);
+    out[10] = -2.0f / (farVal - nearVal);
+    out[12] = -(right + left) / (right - left);
+    out[13] = -(top + bottom) / (top - bottom);
+    out[14] = -(farVal + nearVal) / (farVal - nearVal);
+}
+
+void mat4_perspective(float* out, float fovy, float aspect, float nearVal, float farVal) {
+    float f = 1.0f / tanf(fovy / 2.0f);
+    mat4_identity(out);
+    out[0] = f / aspect;
+    out[5] = f;
+    out[10] = (farVal + nearVal) / (nearVal - farVal);
+    out[11] = -1.0f;
+    out[14] = (2.0f * farVal * nearVal) / (nearVal - farVal);
+    out[15] = 0.0f; // Important: Set w to 0 for perspective projection
+}
+
+// Each output row is a linear combination of b's rows weighted by a's row,
+// which maps directly onto broadcast + multiply-add.
+#if defined(VECMATH_AVX)
+// Two output rows per 256-bit register
+static void vecmath_mul(float* out, const float* a, const float* b) {
+    __m256 b0 = _mm256_broadcast_ps((const __m128*)(b + 0));
+    __m256 b1 = _mm256_broadcast_ps((const __m128*)(b + 4));
+    __m256 b2 = _mm256_broadcast_ps((const __m128*)(b + 8));
+    __m256 b3 = _mm256_broadcast_ps((const __m128*)(b + 12));
+    // Unaligned: mat4 only guarantees 16 bytes, and loadu costs the same as
+    // load on aligned data
+    __m256 a01 = _mm256_loadu_ps(a);
+    __m256 a23 = _mm256_loadu_ps(a + 8);
+    __m256 r01 = _mm256_mul_ps(_mm256_shuffle_ps(a01, a01, 0x00), b0);
+    r01 = _mm256_add_ps(r01, _mm256_mul_ps(_mm256_shuffle_ps(a01, a01, 0x55), b1));
+    r01 = _mm256_add_ps(r01, _mm256_mul_ps(_mm256_shuffle_ps(a01, a01, 0xAA), b2));
+    r01 = _mm256_add_ps(r01, _mm256_mul_ps(_mm256_shuffle_ps(a01, a01, 0xFF), b3));
+    __m256 r23 = _mm256_mul_ps(_mm256_shuffle_ps(a23, a23, 0x00), b0);
+    r23 = _mm256_add_ps(r23, _mm256_mul_ps(_mm256_shuffle_ps(a23, a23, 0x55), b1));
+    r23 = _mm256_add_ps(r23, _mm256_mul_ps(_mm256_shuffle_ps(a23, a23, 0xAA), b2));
+    r23 = _mm256_add_ps(r23, _mm256_mul_ps(_mm256_shuffle_ps(a23, a23, 0xFF), b3));
+    _mm256_storeu_ps(out, r01);
+    _mm256_storeu_ps(out + 8, r23);
+}
+#elif defined(VECMATH_SSE)
+static void vecmath_mul(float* out, const float* a, const float* b) {
+    __m128 b0 = _mm_loadu_ps(b + 0);
+    __m128 b1 = _mm_loadu_ps(b + 4);
+    __m128 b2 = _mm_loadu_ps(b + 8);
+    __m128 b3 = _mm_loadu_ps(b + 12);
+    __m128 r[4];
+    for (int i = 0; i < 4; ++i) {
+        __m128 row = _mm_mul_ps(_mm_set1_ps(a[i * 4 + 0]), b0);
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[i * 4 + 1]), b1));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[i * 4 + 2]), b2));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[i * 4 + 3]), b3));
+        r[i] = row;
+    }
+    // All inputs are read before the first store, so out may alias a or b
+    for (int i = 0; i < 4; ++i) _mm_storeu_ps(out + i * 4, r[i]);
+}
+#else
+static void vecmath_mul(float* out, const float* a, const float* b) {
+    float temp[16];
+    for (int i = 0; i < 4; ++i) { // row
+        for (int j = 0; j < 4; ++j) { // col
+            temp[i * 4 + j] = 0.0f;
+            for (int k = 0; k < 4; ++k) {
+                temp[i * 4 + j] += a[i * 4 + k] * b[k * 4 + j];
+            }
+        }
+    }
+    memcpy(out, temp, sizeof(temp));
+}
+#endif
+
+void mat4_multiply(float* out, const float* a, const float* b) {
+    vecmath_mul(out, a, b);
+}
+
+void mat4_multiply_batch(mat4* out, const mat4* a, const mat4* b, int n) {
+    for (int i = 0; i < n; ++i)
+        vecmath_mul(out[i].m, a->m, b[i].m);
+}
+
+void mat4_transform_points(vec4* out, const mat4* m, const vec4* in, int n) {
+#if defined(VECMATH_SSE)
+    __m128 c0 = _mm_load_ps(m->m + 0);
+    __m128 c1 = _mm_load_ps(m->m + 4);
+    __m128 c2 = _mm_load_ps(m->m + 8);
+    __m128 c3 = _mm_load_ps(m->m + 12);
+    for (int i = 0; i < n; ++i) {
+        __m128 p = _mm_load_ps(in[i].v);
+        __m128 r = _mm_mul_ps(_mm_shuffle_ps(p, p, 0x00), c0);
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(p, p, 0x55), c1));
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(p, p, 0xAA), c2));
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(p, p, 0xFF), c3));
+        _mm_store_ps(out[i].v, r);
+    }
+#else
+    for (int i = 0; i < n; ++i) {
+        const float* p = in[i].v;
+        float r[4];
+        for (int j = 0; j < 4; ++j)
+            r[j] = m->m[j] * p[0] + m->m[4 + j] * p[1] + m->m[8 + j] * p[2] + m->m[12 + j] * p[3];
+        memcpy(out[i].v, r, sizeof(r));
+    }
+#endif
+}
+
+void frustum_planes(float planes[6][4], const float* clip) {
+    for (int p = 0; p < 6; ++p) {
+        int row = p / 2;
+        float sign = (p & 1) ? -1.0f : 1.0f;
+        // Row 3 +/- row `row` of the column-major matrix
+        for (int i = 0; i < 4; ++i) planes[p][i] = clip[i * 4 + 3] + sign * clip[i * 4 + row];
+        float len = sqrtf(vec3_dot(planes[p], planes[p]));
+        if (len > 1e-12f)
+            for (int i = 0; i < 4; ++i) planes[p][i] /= len;
+    }
+}
+
+// A sphere is culled when it lies fully behind any plane. Each lane sums
+// a*x + b*y + c*z + d in the same order as the scalar tail.
+int frustum_cull_spheres(unsigned char* visible, const float planes[6][4], const float* x, const float* y,
+                         const float* z, const float* r, int n) {
+    int i = 0, count = 0;
+#if defined(VECMATH_AVX)
+    for (; i + 8 <= n; i += 8) {
+        __m256 px = _mm256_loadu_ps(x + i), py = _mm256_loadu_ps(y + i), pz = _mm256_loadu_ps(z + i);
+        __m256 nr = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(r + i));
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < 6; ++p) {
+            __m256 d = _mm256_mul_ps(_mm256_set1_ps(planes[p][0]), px);
+            d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(planes[p][1]), py));
+            d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(planes[p][2]), pz));
+            d = _mm256_add_ps(d, _mm256_set1_ps(planes[p][3]));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, nr, _CMP_GE_OQ));
+        }
+        int mask = _mm256_movemask_ps(inside);
+        for (int k = 0; k < 8; ++k) {
+            visible[i + k] = (mask >> k) & 1;
+            count += visible[i + k];
+        }
+    }
+#endif
+#if defined(VECMATH_SSE)
+    for (; i + 4 <= n; i += 4) {
+        __m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i), pz = _mm_loadu_ps(z + i);
+        __m128 nr = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(r + i));
+        __m128 inside = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps()); // All ones
+        for (int p = 0; p < 6; ++p) {
+            __m128 d = _mm_mul_ps(_mm_set1_ps(planes[p][0]), px);
+            d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(planes[p][1]), py));
+            d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(planes[p][2]), pz));
+            d = _mm_add_ps(d, _mm_set1_ps(planes[p][3]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(d, nr));
+        }
+        int mask = _mm_movemask_ps(inside);
+        for (int k = 0; k < 4; ++k) {
+            visible[i + k] = (mask >> k) & 1;
+            count += visible[i + k];
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        int inside = 1;
+        for (int p = 0; p < 6 && inside; ++p)
+            inside = planes[p][0] * x[i] + planes[p][1] * y[i] + planes[p][2] * z[i] + planes[p][3] >= -r[i];
+        visible[i] = (unsigned char)inside;
+        count += inside;
+    }
+    return count;
+}
+
+// Normal matrix (inverse-transpose of the upper 3x3, column-major 3x3 out).
+// Rotations with uniform scale s only need the upper 3x3 divided by s^2;
+// anything else falls back to the cofactor matrix divided by the determinant.
+void mat4_normal_matrix(float* out, const float* m) {
+    const float* c0 = &m[0];
+    const float* c1 = &m[4];
+    const float* c2 = &m[8];
+    float s0 = vec3_dot(c0, c0), s1 = vec3_dot(c1, c1), s2 = vec3_dot(c2, c2);
+    float eps = 1e-5f * s0;
+    if (fabsf(s0 - s1) <= eps && fabsf(s0 - s2) <= eps &&
+        fabsf(vec3_dot(c0, c1)) <= eps && fabsf(vec3_dot(c0, c2)) <= eps && fabsf(vec3_dot(c1, c2)) <= eps) {
+        float inv = 1.0f / s0;
+        for (int c = 0; c < 3; ++c)
+            for (int r = 0; r < 3; ++r)
+                out[c * 3 + r] = m[c * 4 + r] * inv;
+        return;
+    }
+    // Columns of the cofactor matrix are cross products of the other two columns
+    vec3_cross(&out[0], c1, c2);
+    vec3_cross(&out[3], c2, c0);
+    vec3_cross(&out[6], c0, c1);
+    float det = vec3_dot(c0, &out[0]);
+    float inv = fabsf(det) > 1e-12f ? 1.0f / det : 0.0f;
+    for (int i = 0; i < 9; ++i) out[i] *= inv;
+}
+
+#endif // VECMATH_IMPLEMENTATION
@@ -0,0 +1,319 @@
+// Correctness tests for vecmath.h against the scalar helpers it replaced
+// (no GPU needed). Build once per SIMD path:
+//
+//   gcc -O2 vecmath_test.c -lm -o vecmath_test                    (SSE)
+//   gcc -O2 -mavx2 vecmath_test.c -lm -o vecmath_test             (AVX)
+//   gcc -O2 -DVECMATH_NO_SIMD vecmath_test.c -lm -o vecmath_test  (scalar)
+//
+// Prints one line per check and exits with 1 if any check fails.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define VECMATH_IMPLEMENTATION
+#include "vecmath.h"
+
+#define TEST_ITERATIONS 10000
+#define TEST_EPSILON 1e-5f
+
+// --- Reference Implementation ---
+// The scalar helpers as they were in minimal_code.c before vecmath.h
+void ref_mat4_identity(float* m) {
+    memset(m, 0, 16 * sizeof(float));
+    m[0] = m[5] = m[10] = m[15] = 1.0f;
+}
+
+void ref_vec3_cross(float* out, const float* a, const float* b) {
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+float ref_vec3_dot(const float* a, const float* b) {
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+void ref_vec3_normalize(float* v) {
+    float len = sqrtf(ref_vec3_dot(v, v));
+    if (len > 1e-6f) {
+        v[0] /= len;
+        v[1] /= len;
+        v[2] /= len;
+    }
+}
+
+void ref_mat4_lookAt(float* out, const float* eye, const float* center, const float* up) {
+    float f[3], s[3], u[3];
+    f[0] = center[0] - eye[0]; f[1] = center[1] - eye[1]; f[2] = center[2] - eye[2];
+    ref_vec3_normalize(f);
+    ref_vec3_cross(s, f, up);
+    ref_vec3_normalize(s);
+    ref_vec3_cross(u, s, f);
+
+    ref_mat4_identity(out);
+    out[0] = s[0];  out[4] = s[1];  out[8] = s[2];
+    out[1] = u[0];  out[5] = u[1];  out[9] = u[2];
+    out[2] = -f[0]; out[6] = -f[1]; out[10] = -f[2];
+    out[12] = -ref_vec3_dot(s, eye);
+    out[13] = -ref_vec3_dot(u, eye);
+    out[14] = ref_vec3_dot(f, eye);
+}
+
+void ref_mat4_ortho(float* out, float left, float right, float bottom, float top, float nearVal, float farVal) {
+    ref_mat4_identity(out);
+    out[0] = 2.0f / (right - left);
+    out[5] = 2.0f / (top - bottom);
+    out[10] = -2.0f / (farVal - nearVal);
+    out[12] = -(right + left) / (right - left);
+    out[13] = -(top + bottom) / (top - bottom);
+    out[14] = -(farVal + nearVal) / (farVal - nearVal);
+}
+
+void ref_mat4_perspective(float* out, float fovy, float aspect, float nearVal, float farVal) {
+    float f = 1.0f / tanf(fovy / 2.0f);
+    ref_mat4_identity(out);
+    out[0] = f / aspect;
+    out[5] = f;
+    out[10] = (farVal + nearVal) / (nearVal - farVal);
+    out[11] = -1.0f;
+    out[14] = (2.0f * farVal * nearVal) / (nearVal - farVal);
+    out[15] = 0.0f;
+}
+
+void ref_mat4_multiply(float* out, const float* a, const float* b) {
+    float temp[16];
+    for (int i = 0; i < 4; ++i) { // row
+        for (int j = 0; j < 4; ++j) { // col
+            temp[i * 4 + j] = 0.0f;
+            for (int k = 0; k < 4; ++k) {
+                temp[i * 4 + j] += a[i * 4 + k] * b[k * 4 + j];
+            }
+        }
+    }
+    memcpy(out, temp, sizeof(temp));
+}
+
+// Column vector: out = m * p
+void ref_mat4_transform_point(float* out, const float* m, const float* p) {
+    for (int j = 0; j < 4; ++j)
+        out[j] = m[j] * p[0] + m[4 + j] * p[1] + m[8 + j] * p[2] + m[12 + j] * p[3];
+}
+// --- End Reference Implementation ---
+
+// --- Helpers ---
+unsigned int test_seed = 12345u;
+int test_failures = 0;
+
+// Uniform in [lo, hi), reproducible across platforms
+float test_random(float lo, float hi) {
+    test_seed = test_seed * 1664525u + 1013904223u;
+    return lo + (hi - lo) * (float)(test_seed >> 8) / 16777216.0f;
+}
+
+void test_random_floats(float* out, int n, float lo, float hi) {
+    for (int i = 0; i < n; ++i) out[i] = test_random(lo, hi);
+}
+
+// Largest difference relative to max(1, |expected|)
+float test_error(const float* got, const float* expected, int n) {
+    float worst = 0.0f;
+    for (int i = 0; i < n; ++i) {
+        float scale = fabsf(expected[i]) > 1.0f ? fabsf(expected[i]) : 1.0f;
+        float err = fabsf(got[i] - expected[i]) / scale;
+        if (err != err) err = INFINITY; // NaN
+        if (err > worst) worst = err;
+    }
+    return worst;
+}
+
+void test_report(const char* name, float worst) {
+    int ok = worst <= TEST_EPSILON;
+    printf("%-40s %s (max error %g)\n", name, ok ? "ok" : "FAIL", worst);
+    if (!ok) test_failures++;
+}
+
+float test_max(float a, float b) {
+    return a > b ? a : b;
+}
+
+// Backing store for the alignment cases, from malloc as in the renderer
+#define TEST_POOL_SIZE (64 * sizeof(mat4) + 64)
+unsigned char* test_pool[2];
+
+// Buffer `which` at `offset` bytes past a 32-byte boundary: 16 is 16-byte
+// but not 32-byte aligned, 4 is only float aligned
+unsigned char* test_buffer(int which, int offset) {
+    uintptr_t p = (uintptr_t)test_pool[which];
+    return test_pool[which] + ((offset - (p & 31)) & 31);
+}
+
+// The alignment cases call through these so they run the library's
+// out-of-line code, as other call sites do, rather than a copy inlined here
+// where the compiler can fold the alignment away
+void (*test_multiply)(float*, const float*, const float*) = mat4_multiply;
+void (*test_multiply_batch)(mat4*, const mat4*, const mat4*, int) = mat4_multiply_batch;
+void (*test_transform_points)(vec4*, const mat4*, const vec4*, int) = mat4_transform_points;
+// --- End Helpers ---
+
+// --- Tests ---
+void test_vec3_normalize(void) {
+    float worst = 0.0f;
+    for (int it = 0; it < TEST_ITERATIONS; ++it) {
+        float v[3], expected[3];
+        test_random_floats(v, 3, -100.0f, 100.0f);
+        if (it % 100 == 0) v[0] = v[1] = v[2] = 1e-8f; // Below the length cutoff: left unchanged
+        memcpy(expected, v, sizeof(v));
+        vec3_normalize(v);
+        ref_vec3_normalize(expected);
+        worst = test_max(worst, test_error(v, expected, 3));
+    }
+    test_report("vec3_normalize", worst);
+}
+
+void test_mat4_lookAt(void) {
+    float worst = 0.0f;
+    const float up[3] = { 0.0f, 1.0f, 0.0f };
+    for (int it = 0; it < TEST_ITERATIONS; ++it) {
+        float eye[3], center[3], got[16], expected[16];
+        test_random_floats(eye, 3, -50.0f, 50.0f);
+        test_random_floats(center, 3, -50.0f, 50.0f);
+        mat4_lookAt(got, eye, center, up);
+        ref_mat4_lookAt(expected, eye, center, up);
+        worst = test_max(worst, test_error(got, expected, 16));
+    }
+    test_report("mat4_lookAt", worst);
+}
+
+void test_mat4_perspective(void) {
+    float worst = 0.0f;
+    for (int it = 0; it < TEST_ITERATIONS; ++it) {
+        float fovy = test_random(0.1f, 3.0f), aspect = test_random(0.25f, 4.0f);
+        float nearVal = test_random(0.01f, 1.0f), farVal = nearVal + test_random(1.0f, 1000.0f);
+        float got[16], expected[16];
+        mat4_perspective(got, fovy, aspect, nearVal, farVal);
+        ref_mat4_perspective(expected, fovy, aspect, nearVal, farVal);
+        worst = test_max(worst, test_error(got, expected, 16));
+    }
+    test_report("mat4_perspective", worst);
+}
+
+void test_mat4_ortho(void) {
+    float worst = 0.0f;
+    for (int it = 0; it < TEST_ITERATIONS; ++it) {
+        float left = test_random(-50.0f, 0.0f), right = left + test_random(1.0f, 100.0f);
+        float bottom = test_random(-50.0f, 0.0f), top = bottom + test_random(1.0f, 100.0f);
+        float nearVal = test_random(-10.0f, 10.0f), farVal = nearVal + test_random(1.0f, 100.0f);
+        float got[16], expected[16];
+        mat4_ortho(got, left, right, bottom, top, nearVal, farVal);
+        ref_mat4_ortho(expected, left, right, bottom, top, nearVal, farVal);
+        worst = test_max(worst, test_error(got, expected, 16));
+    }
+    test_report("mat4_ortho", worst);
+}
+
+// offset: byte offset of the operands from a 32-byte boundary
+void test_mat4_multiply(const char* name, int offset) {
+    float* a = (float*)test_buffer(0, offset);
+    float* b = (float*)test_buffer(1, offset);
+    float out[16], expected[16];
+    float worst = 0.0f;
+    for (int it = 0; it < TEST_ITERATIONS; ++it) {
+        test_random_floats(a, 16, -2.0f, 2.0f);
+        test_random_floats(b, 16, -2.0f, 2.0f);
+        ref_mat4_multiply(expected, a, b);
+        test_multiply(out, a, b);
+        worst = test_max(worst, test_error(out, expected, 16));
+        // out may alias a or b
+        float saved[16];
+        memcpy(saved, a, sizeof(saved));
+        test_multiply(a, a, b);
+        worst = test_max(worst, test_error(a, expected, 16));
+        memcpy(a, saved, sizeof(saved));
+        test_multiply(b, a, b);
+        worst = test_max(worst, test_error(b, expected, 16));
+    }
+    test_report(name, worst);
+}
+
+// offset: 0 (32-byte aligned) or 16 (16-byte aligned only)
+void test_mat4_multiply_batch(const char* name, int offset) {
+    enum { N = 64 };
+    mat4* b = (mat4*)test_buffer(0, offset);
+    mat4* out = (mat4*)test_buffer(1, offset);
+    mat4 a;
+    float expected[N][16];
+    float worst = 0.0f;
+    for (int it = 0; it < TEST_ITERATIONS / N; ++it) {
+        test_random_floats(a.m, 16, -2.0f, 2.0f);
+        for (int i = 0; i < N; ++i) {
+            test_random_floats(b[i].m, 16, -2.0f, 2.0f);
+            ref_mat4_multiply(expected[i], a.m, b[i].m);
+        }
+        test_multiply_batch(out, &a, b, N);
+        for (int i = 0; i < N; ++i) worst = test_max(worst, test_error(out[i].m, expected[i], 16));
+        test_multiply_batch(b, &a, b, N); // out may alias b
+        for (int i = 0; i < N; ++i) worst = test_max(worst, test_error(b[i].m, expected[i], 16));
+    }
+    test_report(name, worst);
+}
+
+// offset: 0 (32-byte aligned) or 16 (16-byte aligned only)
+void test_mat4_transform_points(const char* name, int offset) {
+    enum { N = 64 };
+    vec4* in = (vec4*)test_buffer(0, offset);
+    vec4* out = (vec4*)test_buffer(1, offset);
+    mat4 m;
+    float expected[N][4];
+    float worst = 0.0f;
+    for (int it = 0; it < TEST_ITERATIONS / N; ++it) {
+        test_random_floats(m.m, 16, -2.0f, 2.0f);
+        for (int i = 0; i < N; ++i) {
+            test_random_floats(in[i].v, 4, -100.0f, 100.0f);
+            ref_mat4_transform_point(expected[i], m.m, in[i].v);
+        }
+        test_transform_points(out, &m, in, N);
+        for (int i = 0; i < N; ++i) worst = test_max(worst, test_error(out[i].v, expected[i], 4));
+        test_transform_points(in, &m, in, N); // out may alias in
+        for (int i = 0; i < N; ++i) worst = test_max(worst, test_error(in[i].v, expected[i], 4));
+    }
+    test_report(name, worst);
+}
+// --- End Tests ---
+
+int main(void) {
+#if defined(VECMATH_AVX)
+    printf("vecmath_test: AVX path\n");
+#elif defined(VECMATH_SSE)
+    printf("vecmath_test: SSE path\n");
+#else
+    printf("vecmath_test: scalar path\n");
+#endif
+    test_pool[0] = malloc(TEST_POOL_SIZE);
+    test_pool[1] = malloc(TEST_POOL_SIZE);
+    if (!test_pool[0] || !test_pool[1]) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    test_vec3_normalize();
+    test_mat4_lookAt();
+    test_mat4_perspective();
+    test_mat4_ortho();
+    test_mat4_multiply("mat4_multiply (32-byte aligned)", 0);
+    test_mat4_multiply("mat4_multiply (16-byte aligned)", 16);
+    test_mat4_multiply("mat4_multiply (unaligned)", 4);
+    test_mat4_multiply_batch("mat4_multiply_batch (32-byte aligned)", 0);
+    test_mat4_multiply_batch("mat4_multiply_batch (16-byte aligned)", 16);
+    test_mat4_transform_points("mat4_transform_points (32-byte aligned)", 0);
+    test_mat4_transform_points("mat4_transform_points (16-byte aligned)", 16);
+
+    free(test_pool[0]);
+    free(test_pool[1]);
+    if (test_failures) {
+        printf("%d check(s) failed\n", test_failures);
+        exit(1);
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -3,21 +3,59 @@ layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoord;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 lightSpaceMatrix;
+// Permutation defines, prepended by compile_shader(); defaults if compiled as-is
+#ifndef INSTANCE_FETCH
+#define INSTANCE_FETCH 0
+#endif
+#ifndef SHADER_NORMAL_MATRIX
+#define SHADER_NORMAL_MATRIX 0 // 1: old per-vertex inverse, kept for A/B benchmarks
+#endif
+
+#if INSTANCE_FETCH
+// GPU culling: each instance is an index into the instance buffer, which is
+// read through a texture buffer (7 RGBA32F texels per instance)
+layout(location = 11) in uint aInstanceIndex;
+uniform samplerBuffer instances;
+#else
+layout(location = 3) in mat4 aModel;   // per instance
+layout(location = 7) in vec3 aColor;   // per instance
+layout(location = 8) in mat3 aNormalMatrix; // per instance, computed on the CPU
+#endif
+
+layout(std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    mat4 lightSpaceMatrices[4];
+    vec4 cascadeSplits; // View-space far distance of each cascade
+    vec3 lightDir;
+    int cascadeCount;
+    vec3 viewPos;
+};
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoord;
-out vec4 FragPosLightSpace;
+out vec3 ObjectColor;
 
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;
+#if INSTANCE_FETCH
+    int texel = int(aInstanceIndex) * 7;
+    mat4 aModel = mat4(texelFetch(instances, texel), texelFetch(instances, texel + 1),
+                       texelFetch(instances, texel + 2), texelFetch(instances, texel + 3));
+    vec4 t4 = texelFetch(instances, texel + 4);
+    vec4 t5 = texelFetch(instances, texel + 5);
+    vec4 t6 = texelFetch(instances, texel + 6);
+    vec3 aColor = t4.xyz;
+    mat3 aNormalMatrix = mat3(vec3(t4.w, t5.xy), vec3(t5.zw, t6.x), t6.yzw);
+#endif
+    FragPos = vec3(aModel * vec4(aPos, 1.0));
+#if SHADER_NORMAL_MATRIX
+    Normal = mat3(transpose(inverse(aModel))) * aNormal;
+#else
+    Normal = aNormalMatrix * aNormal;
+#endif
     TexCoord = aTexCoord;
     gl_Position = projection * view * vec4(FragPos, 1.0);
-    FragPosLightSpace = lightSpaceMatrix * vec4(FragPos, 1.0);
+    ObjectColor = aColor;
 } 
\ No newline at end of file